@@ -0,0 +1,101 @@
+// throughput of BatchExecutor by the number of threads, against the
+// in-process server(server.h).
+//
+//   author/benchmark/batch [-n requests] [-t threads,...] [-d delay_msec] [-p max_per_host]
+//
+// the server answers /delay/N after N msec, so the requests are bound by
+// the latency like the real servers, and the throughput should scale
+// with the threads until the CPU is saturated.
+
+#include "../../nanowww.h"
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <vector>
+#include <string>
+
+static void usage() {
+    fprintf(stderr, "Usage: batch [-n requests] [-t threads,...] [-d delay_msec] [-p max_per_host]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int requests = 400;
+    int delay = 5;
+    int max_per_host = 0;
+    std::vector<int> thread_counts;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:d:p:")) != -1) {
+        switch (opt) {
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        case 't': {
+            std::string list(optarg);
+            size_t pos = 0;
+            while (pos <= list.size()) {
+                size_t comma = list.find(',', pos);
+                if (comma == std::string::npos) { comma = list.size(); }
+                int n = atoi(list.substr(pos, comma - pos).c_str());
+                if (n > 0) { thread_counts.push_back(n); }
+                pos = comma + 1;
+            }
+            break;
+        }
+        case 'd':
+            delay = atoi(optarg);
+            break;
+        case 'p':
+            max_per_host = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (requests <= 0 || delay < 0 || max_per_host < 0) {
+        usage();
+    }
+    if (thread_counts.empty()) {
+        for (int n=1; n<=32; n*=2) {
+            thread_counts.push_back(n);
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    BenchServer server;
+    if (!server.start()) {
+        perror("server");
+        return 1;
+    }
+    std::ostringstream path;
+    path << "/delay/" << delay;
+    std::string url = server.url(path.str().c_str());
+    std::vector<nanowww::Request*> reqs;
+    for (int i=0; i<requests; i++) {
+        reqs.push_back(new nanowww::Request("GET", url.c_str()));
+    }
+
+    nanowww::SharedClient::Config config;
+    config.keepalive = true;
+    int errors = 0;
+    double base = 0;
+    printf("threads,requests,errors,seconds,req_per_sec,speedup\n");
+    for (size_t t=0; t<thread_counts.size(); t++) {
+        nanowww::BatchExecutor executor(thread_counts[t], max_per_host, config);
+        std::vector<nanowww::BatchExecutor::Result> results;
+        double start = nanowww::monotonic_time();
+        int ok = (int)executor.run(reqs, &results);
+        double elapsed = nanowww::monotonic_time() - start;
+        double rate = requests / elapsed;
+        if (t == 0) {
+            base = rate / thread_counts[0];
+        }
+        printf("%d,%d,%d,%.4f,%.1f,%.2f\n", thread_counts[t], requests, requests - ok, elapsed, rate, rate / base);
+        errors += requests - ok;
+    }
+    for (size_t i=0; i<reqs.size(); i++) {
+        delete reqs[i];
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,268 @@
+#ifndef NANOWWW_BENCHMARK_SERVER_H_
+#define NANOWWW_BENCHMARK_SERVER_H_
+
+// tiny HTTP/1.1 server for the benchmarks. one thread per connection.
+//
+//   GET  /small       13 bytes
+//   GET  /large       1MB
+//   GET  /chunked     64KB in 4KB chunks
+//   GET  /delay/N     13 bytes after N msec
+//   POST, PUT         reads the body(Content-Length or chunked), returns its length
+
+#include <picohttpparser/picohttpparser.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <strings.h>
+#include <string>
+#include <sstream>
+
+class BenchServer {
+private:
+    int listen_fd_;
+    unsigned short port_;
+    pthread_t thread_;
+    std::string large_;
+    std::string chunked_;
+public:
+    BenchServer() : listen_fd_(-1), port_(0) {
+        large_.assign(1024 * 1024, 'x');
+        std::string chunk(4096, 'x');
+        for (int i=0; i<16; i++) {
+            chunked_ += "1000\r\n" + chunk + "\r\n";
+        }
+        chunked_ += "0\r\n\r\n";
+    }
+    ~BenchServer() {
+        this->stop();
+    }
+    /// listen on 127.0.0.1 with an ephemeral port
+    bool start() {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(sin);
+        if (bind(listen_fd_, (struct sockaddr *)&sin, len) != 0 || listen(listen_fd_, 1024) != 0) {
+            return false;
+        }
+        getsockname(listen_fd_, (struct sockaddr *)&sin, &len);
+        port_ = ntohs(sin.sin_port);
+        return pthread_create(&thread_, NULL, BenchServer::accept_main, this) == 0;
+    }
+    void stop() {
+        if (listen_fd_ != -1) {
+            shutdown(listen_fd_, SHUT_RDWR);
+            pthread_join(thread_, NULL);
+            close(listen_fd_);
+            listen_fd_ = -1;
+        }
+    }
+    unsigned short port() { return port_; }
+    std::string url(const char *path) {
+        std::ostringstream os;
+        os << "http://127.0.0.1:" << port_ << path;
+        return os.str();
+    }
+private:
+    struct Conn {
+        BenchServer *server;
+        int fd;
+    };
+    static void * accept_main(void *arg) {
+        BenchServer *self = (BenchServer *)arg;
+        while (1) {
+            int fd = accept(self->listen_fd_, NULL, NULL);
+            if (fd == -1) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return NULL;
+            }
+            int opt = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            Conn *conn = new Conn;
+            conn->server = self;
+            conn->fd = fd;
+            pthread_t th;
+            if (pthread_create(&th, NULL, BenchServer::conn_main, conn) == 0) {
+                pthread_detach(th);
+            } else {
+                close(fd);
+                delete conn;
+            }
+        }
+    }
+    static void * conn_main(void *arg) {
+        Conn *conn = (Conn *)arg;
+        conn->server->serve(conn->fd);
+        close(conn->fd);
+        delete conn;
+        return NULL;
+    }
+    /// length of the chunked body in buf, or -2 if incomplete, -1 on error
+    static ssize_t skip_chunked(const char *buf, size_t len, size_t *body_len) {
+        size_t pos = 0;
+        *body_len = 0;
+        while (1) {
+            const char *eol = (const char *)memmem(buf + pos, len - pos, "\r\n", 2);
+            if (!eol) {
+                return -2;
+            }
+            char *end;
+            size_t size = strtoul(buf + pos, &end, 16);
+            if (end == buf + pos) {
+                return -1;
+            }
+            pos = eol - buf + 2;
+            if (size == 0) { // no trailers
+                return len - pos >= 2 ? (ssize_t)(pos + 2) : -2;
+            }
+            if (len - pos < size + 2) {
+                return -2;
+            }
+            pos += size + 2;
+            *body_len += size;
+        }
+    }
+    static bool send_all(int fd, struct iovec *iov, int iovcnt) {
+        while (iovcnt > 0) {
+            ssize_t sent = writev(fd, iov, iovcnt);
+            if (sent <= 0) {
+                if (sent < 0 && errno == EINTR) { continue; }
+                return false;
+            }
+            while (iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+                sent -= iov->iov_len;
+                ++iov; --iovcnt;
+            }
+            if (iovcnt > 0) {
+                iov->iov_base = (char *)iov->iov_base + sent;
+                iov->iov_len -= sent;
+            }
+        }
+        return true;
+    }
+    void serve(int fd) {
+        std::string buf;
+        char rbuf[64 * 1024];
+        while (1) {
+            const char *method, *path;
+            size_t method_len, path_len, num_headers;
+            struct phr_header headers[64];
+            int minor_version;
+            int header_len;
+            while (1) {
+                num_headers = sizeof(headers) / sizeof(headers[0]);
+                header_len = phr_parse_request(buf.c_str(), buf.size(), &method, &method_len,
+                    &path, &path_len, &minor_version, headers, &num_headers, 0);
+                if (header_len != -2) {
+                    break;
+                }
+                ssize_t n = recv(fd, rbuf, sizeof(rbuf), 0);
+                if (n <= 0) {
+                    return;
+                }
+                buf.append(rbuf, n);
+            }
+            if (header_len < 0) {
+                return;
+            }
+
+            bool keepalive = minor_version == 1;
+            bool chunked = false;
+            size_t content_length = 0;
+            for (size_t i=0; i<num_headers; i++) {
+                std::string name(headers[i].name, headers[i].name_len);
+                std::string value(headers[i].value, headers[i].value_len);
+                if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+                    content_length = strtoul(value.c_str(), NULL, 10);
+                } else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+                    chunked = strcasecmp(value.c_str(), "chunked") == 0;
+                } else if (strcasecmp(name.c_str(), "Connection") == 0) {
+                    keepalive = strcasecmp(value.c_str(), "keep-alive") == 0;
+                }
+            }
+            std::string method_s(method, method_len);
+            std::string path_s(path, path_len);
+
+            // read the request body
+            size_t body_len = 0;
+            size_t request_len = header_len;
+            while (1) {
+                if (chunked) {
+                    ssize_t ret = skip_chunked(buf.c_str() + header_len, buf.size() - header_len, &body_len);
+                    if (ret == -1) {
+                        return;
+                    }
+                    if (ret >= 0) {
+                        request_len += ret;
+                        break;
+                    }
+                } else if (buf.size() - header_len >= content_length) {
+                    body_len = content_length;
+                    request_len += content_length;
+                    break;
+                }
+                ssize_t n = recv(fd, rbuf, sizeof(rbuf), 0);
+                if (n <= 0) {
+                    return;
+                }
+                buf.append(rbuf, n);
+            }
+            buf.erase(0, request_len);
+
+            std::ostringstream body;
+            const std::string *content = NULL;
+            bool chunked_response = false;
+            if (method_s == "POST" || method_s == "PUT") {
+                body << body_len;
+            } else if (path_s == "/large") {
+                content = &large_;
+            } else if (path_s == "/chunked") {
+                content = &chunked_;
+                chunked_response = true;
+            } else {
+                if (path_s.compare(0, 7, "/delay/") == 0) {
+                    usleep(atoi(path_s.c_str() + 7) * 1000);
+                }
+                body << "Hello, world!";
+            }
+            std::string small = body.str();
+            if (!content) {
+                content = &small;
+            }
+
+            std::ostringstream head;
+            head << "HTTP/1." << minor_version << " 200 OK\r\n"
+                 << "Content-Type: text/plain\r\n";
+            if (chunked_response) {
+                head << "Transfer-Encoding: chunked\r\n";
+            } else {
+                head << "Content-Length: " << content->size() << "\r\n";
+            }
+            head << (keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n")
+                 << "\r\n";
+            std::string h = head.str();
+            struct iovec iov[2];
+            iov[0].iov_base = (char *)h.data();
+            iov[0].iov_len  = h.size();
+            iov[1].iov_base = (char *)content->data();
+            iov[1].iov_len  = content->size();
+            if (!send_all(fd, iov, 2) || !keepalive) {
+                return;
+            }
+        }
+    }
+};
+
+#endif // NANOWWW_BENCHMARK_SERVER_H_
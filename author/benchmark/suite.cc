@@ -0,0 +1,384 @@
+// benchmark suite against the in-process server(server.h).
+//
+//   author/benchmark/suite [-n requests] [-t threads,...] [-s scenario] [-f csv|json] [-c] [-m]
+//
+// each scenario runs with and without keep-alive, for each thread count.
+// the requests are divided between the threads, one Client per thread.
+// -c runs them with one SharedClient too.
+// -m runs them with one MultiClient per thread too(Linux only), without keep-alive
+// (it doesn't reuse connections), on epoll and on io_uring if the kernel
+// and the build support it. the latency of MultiClient is from the
+// start of the batch, including the time queued by max concurrency.
+// allocations are counted by operator new in the client threads, so the
+// mallocs in libc/OpenSSL and in the server threads are not included.
+
+#include "../../nanowww.h"
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <new>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+// dynamic exception specifications are errors since C++17
+#if __cplusplus < 201103L
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#define NOTHROW throw()
+#else
+#define THROW_BAD_ALLOC
+#define NOTHROW noexcept
+#endif
+
+#define MULTI_CONCURRENCY 32
+
+static __thread unsigned long allocations = 0;
+
+void * operator new(size_t size) THROW_BAD_ALLOC {
+    ++allocations;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void * operator new[](size_t size) THROW_BAD_ALLOC {
+    return operator new(size);
+}
+void operator delete(void *p) NOTHROW {
+    free(p);
+}
+void operator delete[](void *p) NOTHROW {
+    free(p);
+}
+#if __cplusplus >= 201402L
+void operator delete(void *p, size_t) NOTHROW {
+    free(p);
+}
+void operator delete[](void *p, size_t) NOTHROW {
+    free(p);
+}
+#endif
+
+struct Scenario {
+    const char *name;
+    const char *method;
+    const char *path;
+    bool multipart;
+};
+
+static const Scenario scenarios[] = {
+    { "get_small",      "GET",  "/small",   false },
+    { "get_large",      "GET",  "/large",   false },
+    { "get_chunked",    "GET",  "/chunked", false },
+    { "post_small",     "POST", "/post",    false },
+    { "post_multipart", "POST", "/upload",  true  },
+};
+
+enum Mode {
+    MODE_CLIENT, // Client per thread
+    MODE_SHARED, // one SharedClient
+    MODE_MULTI,      // MultiClient per thread, on epoll
+    MODE_MULTI_URING // MultiClient per thread, on io_uring
+};
+
+static const char *mode_names[] = { "client", "shared", "multi", "multi_uring" };
+
+struct Result {
+    std::string scenario;
+    int threads;
+    bool keepalive;
+    Mode mode;
+    int requests;
+    int errors;
+    double elapsed;
+    double p50, p99, p999;
+    double allocs_per_request;
+};
+
+struct Worker {
+    const Scenario *scenario;
+    std::string url;
+    std::string upload;
+    bool keepalive;
+    Mode mode;
+    nanowww::SharedClient *shared; // for MODE_SHARED
+    int requests;
+    // results
+    std::vector<double> latencies;
+    int errors;
+    unsigned long allocations;
+    pthread_t thread;
+};
+
+static nanowww::Request * make_request(Worker *w) {
+    if (w->scenario->multipart) {
+        nanowww::RequestFormData *form = new nanowww::RequestFormData(w->scenario->method, w->url.c_str());
+        form->add_string("name", "nanowww");
+        form->add_file("file", w->upload);
+        return form;
+    } else if (strcmp(w->scenario->method, "POST") == 0) {
+        return new nanowww::Request(w->scenario->method, w->url.c_str(), "key=value&foo=bar");
+    }
+    return new nanowww::Request(w->scenario->method, w->url.c_str());
+}
+
+#ifdef __linux__
+// records when the response of MultiClient is complete
+class TimingHandler : public nanowww::BufferingHandler {
+public:
+    double done;
+    TimingHandler(nanowww::Response *res) : nanowww::BufferingHandler(res), done(0) { }
+    void on_complete(nanowww::Response &res) {
+        done = nanowww::monotonic_time();
+        nanowww::BufferingHandler::on_complete(res);
+    }
+};
+
+static void run_multi(Worker *w) {
+    std::vector<nanowww::Request*> reqs;
+    std::vector<nanowww::Response> res(w->requests);
+    std::vector<TimingHandler*> handlers;
+    nanowww::MultiClient multi(w->mode == MODE_MULTI_URING ? nanowww::MultiClient::BACKEND_URING : nanowww::MultiClient::BACKEND_EPOLL);
+    multi.set_max_concurrency(MULTI_CONCURRENCY);
+    for (int i=0; i<w->requests; i++) {
+        reqs.push_back(make_request(w));
+        handlers.push_back(new TimingHandler(&res[i]));
+        multi.add(*reqs[i], &res[i], handlers[i]);
+    }
+    double start = nanowww::monotonic_time();
+    multi.run();
+    for (int i=0; i<w->requests; i++) {
+        w->latencies.push_back(handlers[i]->done - start);
+        if (!multi.is_success(i) || res[i].status() != 200) {
+            ++w->errors;
+        }
+        delete handlers[i];
+        delete reqs[i];
+    }
+}
+#endif
+
+static void * worker_main(void *arg) {
+    Worker *w = (Worker *)arg;
+    w->latencies.reserve(w->requests);
+    unsigned long start_allocations = allocations;
+#ifdef __linux__
+    if (w->mode == MODE_MULTI || w->mode == MODE_MULTI_URING) {
+        run_multi(w);
+        w->allocations = allocations - start_allocations;
+        return NULL;
+    }
+#endif
+    nanowww::Client client;
+    client.set_keepalive(w->keepalive);
+    for (int i=0; i<w->requests; i++) {
+        nanowww::Response res;
+        double start = nanowww::monotonic_time();
+        nanowww::ScopedPtr<nanowww::Request> req(make_request(w));
+        bool ok = w->mode == MODE_SHARED ? w->shared->send_request(*req, &res) : client.send_request(*req, &res);
+        w->latencies.push_back(nanowww::monotonic_time() - start);
+        if (!ok || res.status() != 200) {
+            ++w->errors;
+        }
+    }
+    w->allocations = allocations - start_allocations;
+    return NULL;
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+static Result run(BenchServer &server, const Scenario &scenario, const std::string &upload,
+                  bool keepalive, Mode mode, int threads, int requests) {
+    nanowww::SharedClient::Config config;
+    config.keepalive = keepalive;
+    nanowww::SharedClient shared_client(config);
+    std::vector<Worker> workers(threads);
+    for (int i=0; i<threads; i++) {
+        Worker &w = workers[i];
+        w.scenario = &scenario;
+        w.url = server.url(scenario.path);
+        w.upload = upload;
+        w.keepalive = keepalive;
+        w.mode = mode;
+        w.shared = &shared_client;
+        w.requests = requests / threads + (i < requests % threads ? 1 : 0);
+        w.errors = 0;
+        w.allocations = 0;
+    }
+    double start = nanowww::monotonic_time();
+    for (int i=0; i<threads; i++) {
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    for (int i=0; i<threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    Result r;
+    r.scenario = scenario.name;
+    r.threads = threads;
+    r.keepalive = keepalive;
+    r.mode = mode;
+    r.requests = requests;
+    r.elapsed = nanowww::monotonic_time() - start;
+    r.errors = 0;
+    unsigned long allocs = 0;
+    std::vector<double> latencies;
+    for (int i=0; i<threads; i++) {
+        r.errors += workers[i].errors;
+        allocs += workers[i].allocations;
+        latencies.insert(latencies.end(), workers[i].latencies.begin(), workers[i].latencies.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    r.p50  = percentile(latencies, 0.50);
+    r.p99  = percentile(latencies, 0.99);
+    r.p999 = percentile(latencies, 0.999);
+    r.allocs_per_request = requests ? (double)allocs / requests : 0;
+    return r;
+}
+
+static void print_csv(const std::vector<Result> &results) {
+    printf("scenario,threads,keepalive,client,requests,errors,seconds,req_per_sec,p50_ms,p99_ms,p999_ms,allocs_per_req\n");
+    for (size_t i=0; i<results.size(); i++) {
+        const Result &r = results[i];
+        printf("%s,%d,%d,%s,%d,%d,%.4f,%.1f,%.3f,%.3f,%.3f,%.1f\n",
+            r.scenario.c_str(), r.threads, r.keepalive ? 1 : 0, mode_names[r.mode], r.requests, r.errors, r.elapsed,
+            r.requests / r.elapsed, r.p50 * 1000, r.p99 * 1000, r.p999 * 1000, r.allocs_per_request);
+    }
+}
+
+static void print_json(const std::vector<Result> &results) {
+    printf("{\"version\":\"%s\",\"results\":[\n", nanowww::version());
+    for (size_t i=0; i<results.size(); i++) {
+        const Result &r = results[i];
+        printf("  {\"scenario\":\"%s\",\"threads\":%d,\"keepalive\":%s,\"client\":\"%s\",\"requests\":%d,\"errors\":%d,"
+               "\"seconds\":%.4f,\"req_per_sec\":%.1f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,"
+               "\"allocs_per_req\":%.1f}%s\n",
+            r.scenario.c_str(), r.threads, r.keepalive ? "true" : "false", mode_names[r.mode],
+            r.requests, r.errors, r.elapsed,
+            r.requests / r.elapsed, r.p50 * 1000, r.p99 * 1000, r.p999 * 1000, r.allocs_per_request,
+            i + 1 < results.size() ? "," : "");
+    }
+    printf("]}\n");
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: suite [-n requests] [-t threads,...] [-s scenario] [-f csv|json] [-c] [-m]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int requests = 2000;
+    std::vector<int> thread_counts;
+    std::string only;
+    std::string format = "csv";
+    std::vector<Mode> modes(1, MODE_CLIENT);
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:s:f:cm")) != -1) {
+        switch (opt) {
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        case 't': {
+            std::string list(optarg);
+            size_t pos = 0;
+            while (pos <= list.size()) {
+                size_t comma = list.find(',', pos);
+                if (comma == std::string::npos) { comma = list.size(); }
+                int n = atoi(list.substr(pos, comma - pos).c_str());
+                if (n > 0) { thread_counts.push_back(n); }
+                pos = comma + 1;
+            }
+            break;
+        }
+        case 's':
+            only = optarg;
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'c':
+            modes.push_back(MODE_SHARED);
+            break;
+        case 'm': {
+#ifdef __linux__
+            modes.push_back(MODE_MULTI);
+            nanowww::MultiClient multi(nanowww::MultiClient::BACKEND_URING);
+            if (multi.backend() == nanowww::MultiClient::BACKEND_URING) {
+                modes.push_back(MODE_MULTI_URING);
+            } else {
+                fprintf(stderr, "io_uring is not available. skipped.\n");
+            }
+#else
+            fprintf(stderr, "MultiClient is only on Linux. skipped.\n");
+#endif
+            break;
+        }
+        default:
+            usage();
+        }
+    }
+    if (requests <= 0 || (format != "csv" && format != "json")) {
+        usage();
+    }
+    if (thread_counts.empty()) {
+        thread_counts.push_back(1);
+        thread_counts.push_back(4);
+        thread_counts.push_back(16);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // file for multipart upload
+    char upload[] = "/tmp/nanowww-bench-XXXXXX";
+    int fd = mkstemp(upload);
+    assert(fd != -1);
+    std::string data(64 * 1024, 'u');
+    if (write(fd, data.data(), data.size()) != (ssize_t)data.size()) {
+        perror("write");
+        return 1;
+    }
+    close(fd);
+
+    BenchServer server;
+    if (!server.start()) {
+        perror("server");
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for (size_t i=0; i<sizeof(scenarios)/sizeof(scenarios[0]); i++) {
+        if (!only.empty() && only != scenarios[i].name) {
+            continue;
+        }
+        for (int keepalive=1; keepalive>=0; keepalive--) {
+            for (size_t m=0; m<modes.size(); m++) {
+                if ((modes[m] == MODE_MULTI || modes[m] == MODE_MULTI_URING) && keepalive) {
+                    continue;
+                }
+                for (size_t t=0; t<thread_counts.size(); t++) {
+                    results.push_back(run(server, scenarios[i], upload, keepalive, modes[m], thread_counts[t], requests));
+                }
+            }
+        }
+    }
+    unlink(upload);
+
+    if (format == "json") {
+        print_json(results);
+    } else {
+        print_csv(results);
+    }
+    for (size_t i=0; i<results.size(); i++) {
+        if (results[i].errors) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -51,7 +51,101 @@ nanowww - tiny HTTP client library for C/C++
 
 =item how to use I/O multiplexing request
 
-use thread, instead.
+use nanowww::MultiClient. it runs many requests in one epoll loop.
+
+    nanowww::MultiClient multi;
+    multi.add(req1, &res1);
+    multi.add(req2, &res2);
+    multi.run();
+
+nanowww::Client doesn't use signals, so you can also use a Client per thread.
+
+=item how to send many small requests to one host
+
+send_pipelined() writes them back-to-back on one connection(HTTP/1.1
+pipelining), and reads the responses in order. use it for idempotent requests.
+
+    std::vector<nanowww::Request*> reqs;   // GETs to one host
+    std::vector<nanowww::Response*> res;   // same size
+    size_t answered = www.send_pipelined(reqs, res);
+
+=item how to receive gzip compressed response
+
+build with zlib(-DHAVE_ZLIB -lz) and call set_decode_content(true).
+the body is inflated while it's received.
+
+    nanowww::Client www;
+    www.set_decode_content(true);
+
+=item where the time of a request went
+
+build with -DNANOWWW_ENABLE_TIMING. res.timing() has the time of each phase
+(DNS, connect, TLS, request sent, first byte, done), bytes and recv calls.
+Metrics::global() aggregates them for all Clients in the process.
+
+    nanowww::Response::Timing *t = res.timing();
+    printf("%f\n", t->first_byte - t->request_sent);
+    std::cout << nanowww::Metrics::global().format(); // Prometheus text format
+
+=item how to save the body to a file
+
+use save_to_file() or save_to_fd(). the body is not kept in Response.
+on Linux, plain HTTP bodies are moved from the socket to the file by splice(2).
+
+    nanowww::Request req("GET", "http://example.com/big.tar.gz");
+    www.save_to_file(req, &res, "big.tar.gz");
+
+=item how to download a large file
+
+use nanowww::Downloader. it fetches byte ranges over several connections in
+parallel, and writes them into the file. if the server doesn't support Range,
+it's downloaded by one request.
+
+    nanowww::Downloader dl;
+    dl.set_connections(8);
+    dl.download("http://example.com/big.iso", "big.iso");
+
+=item how to cache responses
+
+set nanowww::ResponseCache to the Client. GET responses are kept by
+Cache-Control/Expires, and stale ones are revalidated by ETag/Last-Modified.
+the cached bodies are shared with the Responses, not copied.
+
+    nanowww::ResponseCache cache(16 * 1024 * 1024); // bytes in memory
+    cache.set_disk_tier("/var/cache/myapp", 1024 * 1024 * 1024); // optional
+    www.set_cache(&cache);
+
+=item how to share a Client between threads
+
+nanowww::Client is for one thread. use nanowww::SharedClient instead: the
+settings are given at construction, and the error is returned for each
+request. the idle connections and TLS sessions are shared by the threads.
+
+    nanowww::SharedClient::Config config;
+    config.keepalive = true;
+    nanowww::SharedClient www(config);
+    std::string error;
+    www.send_get(&res, "http://example.com/", &error); // in any thread
+
+=item how to send many requests in parallel without async code
+
+use nanowww::BatchExecutor. it runs the requests on a pool of worker
+threads, and returns the results in the order of the requests.
+
+    nanowww::BatchExecutor executor(16, 4); // 16 threads, 4 requests per host at once
+    std::vector<nanowww::BatchExecutor::Result> results;
+    executor.run(reqs, &results);
+
+=item how to upload a large body without keeping it in memory
+
+give a nanowww::BodySource to Request::set_body(). FdBodySource reads a
+file or pipe, and CallbackBodySource calls your function for the next bytes.
+if the length is unknown, the body is sent by chunked encoding.
+
+    nanowww::FdBodySource source(fd); // Content-Length by fstat(2)
+    nanowww::Request req("PUT", "http://example.com/upload");
+    req.set_body(&source);
+    www.send_request(req, &res);
 
 =item how to use gopher/telnet/ftp.
 
@@ -66,7 +160,6 @@ I don't want to support gopher/telnet/ftp in nanowww.
 #include <nanosocket/nanosocket.h>
 #include <nanouri/nanouri.h>
 #include <picohttpparser/picohttpparser.h>
-#include <nanoalarm/nanoalarm.h>
 #include <nanobase/nanobase.h>
 
 #include <math.h>
@@ -74,12 +167,39 @@ I don't want to support gopher/telnet/ftp in nanowww.
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <strings.h>
 #include <cstring>
 #include <cassert>
 
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
+#include <list>
+#include <deque>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <memory>
@@ -90,68 +210,249 @@ I don't want to support gopher/telnet/ftp in nanowww.
 #define NANOWWW_MAX_HEADERS 64
 #define NANOWWW_READ_BUFFER_SIZE 60*1024
 #define NANOWWW_DEFAULT_MULTIPART_BUFFER_SIZE 60*1024
+#define NANOWWW_BODY_BUFFER_SIZE 64*1024
+#define NANOWWW_DEFAULT_MAX_IDLE_CONNECTIONS 8
+#define NANOWWW_DEFAULT_IDLE_TIMEOUT 30
+#define NANOWWW_POOL_SHARDS 16
+#define NANOWWW_BATCH_THREADS 8
+#define NANOWWW_MAX_CONTENT_RESERVE 64*1024*1024
+#define NANOWWW_URING_ENTRIES 1024
+#ifndef NANOWWW_URING_BUFFERS
+#define NANOWWW_URING_BUFFERS 64
+#endif
+#define NANOWWW_WRITE_BATCH 64
+#define NANOWWW_INFLATE_BUFFER_SIZE 16*1024
+#define NANOWWW_DNS_TTL 60
+#define NANOWWW_DNS_NEGATIVE_TTL 5
+#define NANOWWW_DNS_MAX_ENTRIES 1024
+#define NANOWWW_TLS_MAX_SESSIONS 1024
+#define NANOWWW_MAX_LAST_PEERS 1024
+#define NANOWWW_CONNECTION_ATTEMPT_DELAY 250
+#define NANOWWW_SPLICE_SIZE 256*1024
+#define NANOWWW_DEFAULT_PIPELINE_DEPTH 32
+#define NANOWWW_CACHE_MAX_BYTES 64*1024*1024
+#define NANOWWW_CACHE_HEURISTIC_LIFETIME 24*60*60
+
+// no SIGPIPE on send. without MSG_NOSIGNAL(Mac OS X), SO_NOSIGPIPE is set on the socket.
+#ifdef MSG_NOSIGNAL
+#define NANOWWW_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define NANOWWW_SEND_FLAGS 0
+#endif
 
 namespace nanowww {
     const char *version() {
         return NANOWWW_VERSION;
     }
 
+    /**
+     * view of the string owned by someone else. (pointer + length)
+     * valid while the owner is alive and not modified.
+     */
+    class StringRef {
+    private:
+        const char *ptr_;
+        size_t len_;
+    public:
+        StringRef() : ptr_(NULL), len_(0) { }
+        StringRef(const char *ptr, size_t len) : ptr_(ptr), len_(len) { }
+        StringRef(const std::string &str) : ptr_(str.c_str()), len_(str.size()) { }
+        inline const char * data() const { return ptr_; }
+        inline size_t size() const { return len_; }
+        inline bool empty() const { return len_ == 0; }
+        /// lookup was failed
+        inline bool is_null() const { return ptr_ == NULL; }
+        inline std::string str() const {
+            return ptr_ ? std::string(ptr_, len_) : std::string();
+        }
+        inline bool equals_nocase(const char *s) const {
+            size_t slen = strlen(s);
+            return ptr_ && slen == len_ && strncasecmp(ptr_, s, len_) == 0;
+        }
+        /**
+         * parse as the decimal number.
+         * @return false if it's not a number, or overflowed.
+         */
+        bool to_size(size_t *dst) const {
+            if (!ptr_ || len_ == 0) { return false; }
+            size_t n = 0;
+            for (size_t i=0; i<len_; i++) {
+                if (ptr_[i] < '0' || ptr_[i] > '9') { return false; }
+                size_t next = n * 10 + (ptr_[i] - '0');
+                if (next / 10 != n) { return false; }
+                n = next;
+            }
+            *dst = n;
+            return true;
+        }
+    };
+
+    /**
+     * HTTP headers.
+     * names and values are stored in one buffer, and fields keep the offsets.
+     * field names are case-insensitive, and the insertion order is kept.
+     */
     class Headers {
     private:
-        std::map< std::string, std::vector<std::string> > headers_;
-        typedef std::map< std::string, std::vector<std::string> >::iterator iterator;
+        struct Field {
+            size_t name_off;
+            size_t name_len;
+            size_t value_off;
+            size_t value_len;
+        };
+        std::string buf_;
+        std::vector<Field> fields_;
+        size_t garbage_; // bytes in buf_ which are not referenced anymore
     public:
+        Headers() : garbage_(0) { }
         inline void push_header(const char *key, const char *val) {
-            this->push_header(key, std::string(val));
+            this->push_header(key, strlen(key), val, strlen(val));
         }
         inline void push_header(const char *key, const std::string &val) {
-            iterator iter = headers_.find(key);
-            if (iter != headers_.end()) {
-                iter->second.push_back(val);
-            } else {
-                std::vector<std::string> v;
-                v.push_back(val);
-                headers_[std::string(key)] = v;
+            this->push_header(key, strlen(key), val.c_str(), val.size());
+        }
+        void push_header(const char *key, size_t key_len, const char *val, size_t val_len) {
+            Field f;
+            f.name_off  = buf_.size();
+            f.name_len  = key_len;
+            buf_.append(key, key_len);
+            f.value_off = buf_.size();
+            f.value_len = val_len;
+            buf_.append(val, val_len);
+            fields_.push_back(f);
+        }
+        /**
+         * take the parsed header block as is.
+         * the block is copied into the buffer at once, and each field refers
+         * the slice of it. so there is no allocation per field.
+         * continuation lines(name == NULL) are ignored.
+         */
+        void set_raw(const char *block, size_t block_len, const struct phr_header *headers, size_t num_headers) {
+            this->clear();
+            buf_.append(block, block_len);
+            fields_.reserve(num_headers);
+            for (size_t i=0; i<num_headers; i++) {
+                if (!headers[i].name) {
+                    continue;
+                }
+                assert(headers[i].name  >= block && headers[i].name  + headers[i].name_len  <= block + block_len);
+                assert(headers[i].value >= block && headers[i].value + headers[i].value_len <= block + block_len);
+                Field f;
+                f.name_off  = headers[i].name  - block;
+                f.name_len  = headers[i].name_len;
+                f.value_off = headers[i].value - block;
+                f.value_len = headers[i].value_len;
+                fields_.push_back(f);
             }
+            // the status line and delimiters are not referenced
+            garbage_ = 0;
         }
         inline void remove_header(const char *key) {
-            iterator iter = headers_.find(key);
-            if (iter != headers_.end()) {
-                headers_.erase(iter);
+            size_t key_len = strlen(key);
+            std::vector<Field>::iterator iter = fields_.begin();
+            while (iter != fields_.end()) {
+                if (this->name_is(*iter, key, key_len)) {
+                    garbage_ += iter->name_len + iter->value_len;
+                    iter = fields_.erase(iter);
+                } else {
+                    ++iter;
+                }
             }
+            this->compact_if_needed();
         }
         inline void set_header(const char *key, int val) {
-            char * buf = new char[val/10+2];
+            char buf[sizeof(int)*3+2];
             sprintf(buf, "%d", val);
             this->set_header(key, buf);
-            delete [] buf;
         }
+        /// for sizes, e.g. Content-Length of a body over 4GB
+        inline void set_header(const char *key, unsigned long long val) {
+            char buf[sizeof(unsigned long long)*3+2];
+            snprintf(buf, sizeof(buf), "%llu", val);
+            this->set_header(key, buf);
+        }
+        /**
+         * replace the value of the first field with the name, and remove the rest.
+         * the position of the field is kept.
+         */
         inline void set_header(const char *key, const std::string &val) {
-            this->remove_header(key);
-            this->push_header(key, val);
+            size_t key_len = strlen(key);
+            for (size_t i=0; i<fields_.size(); i++) {
+                Field &f = fields_[i];
+                if (!this->name_is(f, key, key_len)) {
+                    continue;
+                }
+                garbage_ += f.value_len;
+                f.value_off = buf_.size();
+                f.value_len = val.size();
+                buf_.append(val);
+                for (size_t j=fields_.size()-1; j>i; j--) {
+                    if (this->name_is(fields_[j], key, key_len)) {
+                        garbage_ += fields_[j].name_len + fields_[j].value_len;
+                        fields_.erase(fields_.begin() + j);
+                    }
+                }
+                this->compact_if_needed();
+                return;
+            }
+            this->push_header(key, key_len, val.c_str(), val.size());
         }
         inline void set_header(const char *key, const char *val) {
             this->set_header(key, std::string(val));
         }
-        inline std::string get_header(const char *key) {
-            iterator iter = headers_.find(key);
-            if (iter != headers_.end()) {
-                return iter->second[0];
-            }
-            return NULL;
+        inline bool has_header(const char *key) const {
+            return !this->find_header(key).is_null();
         }
-        inline std::string as_string() {
-            std::string res;
-            for ( iterator iter = headers_.begin(); iter != headers_.end(); ++iter ) {
-                std::vector<std::string>::iterator ci = iter->second.begin();
-                for (;ci!=iter->second.end(); ++ci) {
-                    assert(
-                           ci->find('\n') == std::string::npos
-                        && ci->find('\r') == std::string::npos
-                    );
-                    res += iter->first + ": " + (*ci) + "\r\n";
+        /**
+         * @return copy of the first value, or empty string if not found.
+         */
+        inline std::string get_header(const char *key) const {
+            return this->find_header(key).str();
+        }
+        /**
+         * @return the first value without copying it. is_null() if not found.
+         */
+        inline StringRef find_header(const char *key) const {
+            size_t key_len = strlen(key);
+            for (size_t i=0; i<fields_.size(); i++) {
+                if (this->name_is(fields_[i], key, key_len)) {
+                    return this->value(i);
                 }
             }
+            return StringRef();
+        }
+        /// number of fields
+        inline size_t size() const { return fields_.size(); }
+        inline StringRef name(size_t i) const {
+            return StringRef(buf_.data() + fields_[i].name_off, fields_[i].name_len);
+        }
+        inline StringRef value(size_t i) const {
+            return StringRef(buf_.data() + fields_[i].value_off, fields_[i].value_len);
+        }
+        /// remove all fields. allocated memory is kept for reuse.
+        inline void clear() {
+            buf_.clear();
+            fields_.clear();
+            garbage_ = 0;
+        }
+        /// append "Name: value\r\n" lines to dst
+        void append_to(std::string *dst) const {
+            for (size_t i=0; i<fields_.size(); i++) {
+                const Field &f = fields_[i];
+                assert(
+                       memchr(buf_.data() + f.value_off, '\n', f.value_len) == NULL
+                    && memchr(buf_.data() + f.value_off, '\r', f.value_len) == NULL
+                );
+                dst->append(buf_, f.name_off, f.name_len);
+                dst->append(": ", 2);
+                dst->append(buf_, f.value_off, f.value_len);
+                dst->append("\r\n", 2);
+            }
+        }
+        inline std::string as_string() const {
+            std::string res;
+            res.reserve(buf_.size() - garbage_ + fields_.size() * 4);
+            this->append_to(&res);
             return res;
         }
         void set_user_agent(const std::string &ua) {
@@ -175,19 +476,159 @@ namespace nanowww {
             this->set_header(header, std::string("Basic ") + ((const char*)buf));
             delete [] buf;
         }
+        inline bool name_is(const Field &f, const char *key, size_t key_len) const {
+            return f.name_len == key_len && strncasecmp(buf_.data() + f.name_off, key, key_len) == 0;
+        }
+        void compact_if_needed() {
+            if (garbage_ < 1024 || garbage_ < buf_.size() / 2) {
+                return;
+            }
+            std::string buf;
+            buf.reserve(buf_.size() - garbage_);
+            for (size_t i=0; i<fields_.size(); i++) {
+                Field &f = fields_[i];
+                size_t name_off = buf.size();
+                buf.append(buf_, f.name_off, f.name_len);
+                size_t value_off = buf.size();
+                buf.append(buf_, f.value_off, f.value_len);
+                f.name_off  = name_off;
+                f.value_off = value_off;
+            }
+            buf_.swap(buf);
+            garbage_ = 0;
+        }
+    };
+
+    /**
+     * immutable string shared by reference counting, e.g. a cached body
+     * shared by ResponseCache and Responses. copying the handle doesn't copy
+     * the string. thread-safe.
+     */
+    class SharedContent {
+    private:
+        struct Rep {
+            int refs;
+            std::string str;
+        };
+        Rep *rep_;
+    public:
+        SharedContent() : rep_(NULL) { }
+        SharedContent(const SharedContent &other) : rep_(other.rep_) {
+            if (rep_) {
+                __sync_fetch_and_add(&rep_->refs, 1);
+            }
+        }
+        SharedContent & operator=(const SharedContent &other) {
+            SharedContent tmp(other);
+            std::swap(rep_, tmp.rep_);
+            return *this;
+        }
+        ~SharedContent() {
+            this->reset();
+        }
+        inline void reset() {
+            if (rep_ && __sync_sub_and_fetch(&rep_->refs, 1) == 0) {
+                delete rep_;
+            }
+            rep_ = NULL;
+        }
+        /// move the string into a new shared one. *src is empty after this.
+        inline void take(std::string *src) {
+            this->reset();
+            rep_ = new Rep();
+            rep_->refs = 1;
+            rep_->str.swap(*src);
+        }
+        inline bool is_null() const { return rep_ == NULL; }
+        inline const std::string & str() const {
+            static const std::string empty;
+            return rep_ ? rep_->str : empty;
+        }
     };
 
     class Response {
+    public:
+        /// one request/response exchange of a redirect chain.
+        struct Hop {
+            std::string uri;
+            int status;
+            double elapsed; // sec, from sending the request to the end of the body
+            bool reused;    // sent over a pooled connection
+        };
+        /**
+         * phases of one exchange in monotonic_time(), recorded by Client if
+         * the binary is built with -DNANOWWW_ENABLE_TIMING.
+         * phases which didn't happen(e.g. connecting on a reused connection) are 0.
+         * bytes are counted above TLS, including headers.
+         */
+        struct Timing {
+            double start;         // exchange started
+            double connect_start; // started connecting
+            double dns_done;      // host name resolved
+            double connect_done;  // TCP connection established
+            double tls_done;      // TLS handshake finished
+            double request_sent;  // whole request written
+            double first_byte;    // first byte of the response received
+            double done;          // body received, or failed
+            size_t bytes_sent;
+            size_t bytes_received;
+            unsigned int recv_calls;
+            bool reused;          // sent over a pooled connection
+            inline void clear() { memset(this, 0, sizeof(*this)); }
+        };
     private:
         int status_;
         std::string msg_;
         Headers hdr_;
         std::string content_;
+        SharedContent shared_; // the body, instead of content_, if not null
+        std::vector<Hop> hops_;
+#ifdef NANOWWW_ENABLE_TIMING
+        Timing timing_;
+#endif
     public:
         Response() {
             status_ = -1;
+#ifdef NANOWWW_ENABLE_TIMING
+            timing_.clear();
+#endif
         }
         ~Response() { }
+        /**
+         * clear the response for reuse.
+         * allocated buffers are kept, so a recycled response doesn't allocate
+         * on parsing in most cases.
+         */
+        inline void reset() {
+            status_ = -1;
+            msg_.clear();
+            hdr_.clear();
+            content_.clear();
+            shared_.reset();
+            hops_.clear();
+#ifdef NANOWWW_ENABLE_TIMING
+            timing_.clear();
+#endif
+        }
+        /**
+         * parse the status line and headers in buf.
+         * @return same as phr_parse_response(). length of the header part,
+         *         -1 on parse error, -2 if the header is incomplete.
+         */
+        int parse_header(const char *buf, size_t len, size_t last_len, int *minor_version) {
+            int status;
+            const char *msg;
+            size_t msg_len;
+            struct phr_header headers[NANOWWW_MAX_HEADERS];
+            size_t num_headers = sizeof(headers) / sizeof(headers[0]);
+            int ret = phr_parse_response(buf, len, minor_version, &status, &msg, &msg_len, headers, &num_headers, last_len);
+            if (ret > 0) {
+                status_ = status;
+                msg_.assign(msg, msg_len);
+                hdr_.set_raw(buf, ret, headers, num_headers);
+            }
+            return ret;
+        }
         inline bool is_success() {
             return status_ == 200;
         }
@@ -195,502 +636,5757 @@ namespace nanowww {
         inline void set_status(int _status) {
             status_ = _status;
         }
-        inline std::string message() { return msg_; }
+        inline const std::string & message() const { return msg_; }
         inline void set_message(const char *str, size_t len) {
             msg_.assign(str, len);
         }
         inline Headers * headers() { return &hdr_; }
         inline void push_header(const std::string &key, const std::string &val) {
-            hdr_.push_header(key.c_str(), val.c_str());
+            hdr_.push_header(key.c_str(), key.size(), val.c_str(), val.size());
         }
-        inline std::string get_header(const char *key) {
+        inline void push_header(const char *key, size_t key_len, const char *val, size_t val_len) {
+            hdr_.push_header(key, key_len, val, val_len);
+        }
+        inline std::string get_header(const char *key) const {
             return hdr_.get_header(key);
         }
+        /// @return header value without copying. is_null() if not found.
+        inline StringRef find_header(const char *key) const {
+            return hdr_.find_header(key);
+        }
         inline void add_content(const std::string &src) {
-            content_.append(src);
+            this->add_content(src.data(), src.size());
         }
         inline void add_content(const char *src, size_t len) {
+            if (!shared_.is_null()) { // copy on write
+                content_ = shared_.str();
+                shared_.reset();
+            }
             content_.append(src, len);
         }
-        std::string content() { return content_; }
+        /**
+         * the requests made by Client::send_request(), in order.
+         * redirected requests come first, the last one is this response.
+         */
+        inline const std::vector<Hop> & hops() const { return hops_; }
+        inline void set_hops(std::vector<Hop> &hops) { hops_.swap(hops); }
+        /**
+         * timing of the last exchange(the last hop of redirects).
+         * NULL unless the binary is built with -DNANOWWW_ENABLE_TIMING.
+         */
+        inline Timing * timing() {
+#ifdef NANOWWW_ENABLE_TIMING
+            return &timing_;
+#else
+            return NULL;
+#endif
+        }
+        /// preallocate the body buffer, if the length is known.
+        inline void reserve_content(size_t len) {
+            content_.reserve(std::min(len, (size_t)NANOWWW_MAX_CONTENT_RESERVE));
+        }
+        inline const std::string & content() const {
+            return shared_.is_null() ? content_ : shared_.str();
+        }
+        /**
+         * move the body out of the response, without copying.
+         * content() is empty after this call.
+         * a shared body(e.g. from ResponseCache) is copied.
+         */
+        inline void take_content(std::string *dst) {
+            if (!shared_.is_null()) {
+                *dst = shared_.str();
+                shared_.reset();
+                return;
+            }
+            dst->clear();
+            dst->swap(content_);
+        }
+        /**
+         * the body as a SharedContent. the body is moved into it at the first
+         * call, so it's not copied.
+         */
+        inline SharedContent share_content() {
+            if (shared_.is_null()) {
+                shared_.take(&content_);
+            }
+            return shared_;
+        }
+        /// use the shared body, without copying it
+        inline void set_shared_content(const SharedContent &content) {
+            content_.clear();
+            shared_ = content;
+        }
     };
 
-    class Request {
+    /**
+     * receives the response while it arrives.
+     * pass it to Client::send_request() to process the body chunk by chunk,
+     * instead of buffering whole body in Response.
+     */
+    class ResponseHandler {
+    public:
+        virtual ~ResponseHandler() { }
+        /**
+         * status line and headers are available in res.
+         * @return false to abort the request
+         */
+        virtual bool on_header(Response &res) { (void)res; return true; }
+        /// called before on_body() when the body length is known in advance
+        virtual void on_content_length(size_t len) { (void)len; }
+        /**
+         * part of the decoded body.
+         * @return false to abort the request
+         */
+        virtual bool on_body(const char *buf, size_t len) = 0;
+        /**
+         * file descriptor the raw body may be moved into by splice(2), instead
+         * of on_body(). used only for plain HTTP bodies without decoding.
+         * @return fd, or -1(default) to receive the body by on_body().
+         *         *offset is where the next byte goes, or -1 for the current position.
+         */
+        virtual int splice_fd(off_t *offset) { (void)offset; return -1; }
+        /**
+         * len bytes were moved into splice_fd().
+         * @return false to abort the request
+         */
+        virtual bool on_spliced(size_t len) { (void)len; return true; }
+        /// whole body was received
+        virtual void on_complete(Response &res) { (void)res; }
+        /// the request failed. on_complete() is not called.
+        virtual void on_error(const std::string &errstr) { (void)errstr; }
+    };
+
+    /**
+     * default handler, stores the body in Response.
+     */
+    class BufferingHandler : public ResponseHandler {
     private:
-        std::string content_;
-    protected:
-        Headers headers_;
-        std::string method_;
-        nanouri::Uri uri_;
-        size_t content_length_;
+        Response *res_;
     public:
-        Request(const char *method, const char *uri) {
-            this->Init(method, uri);
-            this->set_content("");
+        BufferingHandler(Response *res) : res_(res) { }
+        void on_content_length(size_t len) {
+            res_->reserve_content(len);
         }
-        Request(const char *method, const char *uri, const char *content) {
-            this->Init(method, uri);
-            this->set_content(content);
+        bool on_body(const char *buf, size_t len) {
+            res_->add_content(buf, len);
+            return true;
         }
-        Request(const char *method, const char *uri, std::map<std::string, std::string> &post) {
-            std::string content;
-            std::map<std::string, std::string>::iterator iter = post.begin();
-            for (; iter!=post.end(); ++iter) {
-                if (!content.empty()) { content += "&"; }
-                std::string key = iter->first;
-                std::string val = iter->second;
-                content += nu_escape_uri(key) + "=" + nu_escape_uri(val);
-            }
-            this->set_header("Content-Type", "application/x-www-form-urlencoded");
+    };
 
-            this->Init(method, uri);
-            this->set_content(content.c_str());
+    /**
+     * throws the body away.
+     */
+    class DiscardingHandler : public ResponseHandler {
+    public:
+        bool on_body(const char *buf, size_t len) {
+            (void)buf; (void)len;
+            return true;
         }
-        ~Request() { }
-        virtual bool write_content(nanosocket::Socket & sock) {
-            if (sock.send(content_.c_str(), content_.size()) == (int)content_.size()) {
+    };
+
+    /**
+     * writes the body into a file descriptor.
+     * the body is written at the offset by pwrite(2), or at the current
+     * position by write(2) if the offset is negative(e.g. pipes).
+     * Client may move the body into the fd by splice(2), bypassing on_body().
+     */
+    class FileWriter : public ResponseHandler {
+    private:
+        int fd_;
+        off_t offset_;
+        unsigned long long limit_; // max bytes to write. 0 means no limit
+        unsigned long long written_;
+        bool partial_;             // expects 206 for "Range: bytes=offset-"
+        volatile int *abort_;      // stop writing when this becomes non zero
+        std::string errstr_;
+    public:
+        FileWriter(int fd, off_t offset, unsigned long long limit=0, bool partial=false, volatile int *abort=NULL)
+            : fd_(fd), offset_(offset), limit_(limit), written_(0), partial_(partial), abort_(abort) { }
+        inline unsigned long long written() const { return written_; }
+        inline const std::string & errstr() const { return errstr_; }
+        bool on_header(Response &res) {
+            if (!partial_) {
+                if (res.status() < 200 || res.status() >= 300) {
+                    errstr_ = std::string("unexpected status: ") + res.message();
+                    return false;
+                }
                 return true;
-            } else {
+            }
+            if (res.status() != 206) {
+                // 200 means the server ignored Range, or the resource is changed(If-Range)
+                errstr_ = res.status() == 200 ? "server ignored Range or resource changed"
+                                              : std::string("unexpected status: ") + res.message();
+                return false;
+            }
+            // Content-Range: bytes first-last/total
+            StringRef range = res.find_header("Content-Range");
+            std::string value = range.str();
+            if (range.is_null() || strncasecmp(value.c_str(), "bytes ", 6) != 0
+                    || strtoull(value.c_str() + 6, NULL, 10) != (unsigned long long)offset_) {
+                errstr_ = "unexpected Content-Range";
                 return false;
             }
+            return true;
         }
-        virtual void finalize_header() { }
-        inline void set_header(const char* key, const char *val) {
-            this->headers_.set_header(key, val);
+        bool on_body(const char *buf, size_t len) {
+            if (!this->check(len)) {
+                return false;
+            }
+            while (len > 0) {
+                ssize_t n = offset_ < 0 ? write(fd_, buf, len)
+                                        : pwrite(fd_, buf, len, offset_ + written_);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    errstr_ = strerror(errno);
+                    return false;
+                }
+                buf      += n;
+                len      -= n;
+                written_ += n;
+            }
+            return true;
         }
-        inline void set_header(const char* key, size_t val) {
-            this->headers_.set_header(key, val);
+        int splice_fd(off_t *offset) {
+            *offset = offset_ < 0 ? -1 : offset_ + (off_t)written_;
+            return fd_;
         }
-        inline void push_header(const char* key, const char *val) {
-            this->headers_.push_header(key, val);
+        bool on_spliced(size_t len) {
+            if (!this->check(len)) {
+                return false;
+            }
+            written_ += len;
+            return true;
         }
-        inline std::string get_header(const char* key) {
-            return this->headers_.get_header(key);
+    protected:
+        bool check(size_t len) {
+            if (abort_ && __sync_fetch_and_add(abort_, 0)) {
+                errstr_ = "aborted";
+                return false;
+            }
+            if (limit_ > 0 && written_ + len > limit_) {
+                errstr_ = "body is longer than expected";
+                return false;
+            }
+            return true;
         }
-        bool write_header(nanosocket::Socket &sock, bool is_proxy) {
-            // finalize content-length header
-            this->finalize_header();
-
-            this->set_header("Content-Length", content_length_);
-
-            // make request string
-            std::string hbuf =
-                  method_ + " " + (is_proxy ? uri_.as_string() : uri_.path_query()) + " HTTP/1.0\r\n"
-                + headers_.as_string()
-                + "\r\n"
-            ;
+    };
 
-            // send it
-            return this->send_all(sock, hbuf);
+#ifdef HAVE_ZLIB
+    /**
+     * decodes "Content-Encoding: gzip/deflate" body, and passes it to the
+     * next handler piece by piece. the compressed body is never buffered.
+     */
+    class InflatingHandler : public ResponseHandler {
+    public:
+        enum Encoding {
+            ENCODING_NONE,
+            ENCODING_GZIP,
+            ENCODING_DEFLATE
+        };
+    private:
+        ResponseHandler *next_;
+        Encoding encoding_;
+        z_stream zs_;
+        bool initialized_;
+        bool finished_;
+        std::string errstr_;
+        char out_[NANOWWW_INFLATE_BUFFER_SIZE];
+    public:
+        InflatingHandler(ResponseHandler *next, Encoding encoding)
+            : next_(next), encoding_(encoding), initialized_(false), finished_(false) {
+            memset(&zs_, 0, sizeof(zs_));
         }
+        ~InflatingHandler() {
+            if (initialized_) {
+                inflateEnd(&zs_);
+            }
+        }
+        /// encoding of the response. ENCODING_NONE if it's not supported.
+        static Encoding detect(Response *res) {
+            StringRef ce = res->find_header("Content-Encoding");
+            if (ce.equals_nocase("gzip") || ce.equals_nocase("x-gzip")) {
+                return ENCODING_GZIP;
+            } else if (ce.equals_nocase("deflate")) {
+                return ENCODING_DEFLATE;
+            }
+            return ENCODING_NONE;
+        }
+        /// the decoding failed
+        inline bool is_error() const { return !errstr_.empty(); }
+        inline const std::string & errstr() const { return errstr_; }
+        /// whole stream was decoded(or the body was empty).
+        inline bool is_finished() const { return finished_ || !initialized_; }
 
-        inline Headers *headers() { return &headers_; }
-        inline nanouri::Uri *uri() { return &uri_; }
-        inline void set_uri(const char *uri) { uri_.parse(uri); }
-        inline void set_uri(const std::string &uri) { this->set_uri(uri.c_str()); }
-        inline std::string method() { return method_; }
-
-        void set_user_agent(const char* ua) {
-            this->headers_.set_user_agent(ua);
+        bool on_header(Response &res) {
+            return next_->on_header(res);
         }
-        void set_user_agent(const std::string& ua) {
-            this->headers_.set_user_agent(ua);
-        }
-
-    protected:
-        inline void set_content(const char *content) {
-            content_ = content;
-            content_length_ = content_.size();
-        }
-        inline void Init(const char *method, const char *uri) {
-            method_  = method;
-            assert(uri_.parse(uri));
-            this->set_user_agent(NANOWWW_USER_AGENT);
-            this->set_header("Host", uri_.host().c_str());
+        /// compressed length. decoded body is longer, so it's a hint to reserve.
+        void on_content_length(size_t len) {
+            next_->on_content_length(len);
         }
-        inline bool send_all(nanosocket::Socket &sock, const char *src, ssize_t srclen) {
-            int remains = srclen;
-            while (remains > 0) {
-                ssize_t sent = sock.send(src, remains);
-                if (sent < 0) {
+        bool on_body(const char *buf, size_t len) {
+            if (len == 0 || finished_) {
+                return true; // ignore the garbage after the stream
+            }
+            if (!initialized_ && !this->init((unsigned char)buf[0])) {
+                return false;
+            }
+            zs_.next_in  = (Bytef*)buf;
+            zs_.avail_in = len;
+            while (zs_.avail_in > 0 && !finished_) {
+                zs_.next_out  = (Bytef*)out_;
+                zs_.avail_out = sizeof(out_);
+                int ret = inflate(&zs_, Z_NO_FLUSH);
+                if (ret == Z_STREAM_END) {
+                    finished_ = true;
+                } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                    errstr_ = zs_.msg ? zs_.msg : "broken compressed body";
+                    return false;
+                }
+                size_t produced = sizeof(out_) - zs_.avail_out;
+                if (produced > 0 && !next_->on_body(out_, produced)) {
                     return false;
-                } else {
-                    remains -= sent;
+                }
+                if (ret == Z_BUF_ERROR && produced == 0) {
+                    break; // needs more input
                 }
             }
             return true;
         }
-        inline bool send_all(nanosocket::Socket &sock, const std::string & src) {
-            return this->send_all(sock, src.c_str(), src.size());
+        void on_complete(Response &res) {
+            next_->on_complete(res);
+        }
+        void on_error(const std::string &errstr) {
+            next_->on_error(errstr);
+        }
+    protected:
+        bool init(unsigned char first) {
+            int window_bits = MAX_WBITS + 16; // gzip
+            if (encoding_ == ENCODING_DEFLATE) {
+                // "deflate" should be zlib format(RFC 1950), but some servers send raw deflate.
+                window_bits = (first & 0x0f) == Z_DEFLATED ? MAX_WBITS : -MAX_WBITS;
+            }
+            if (inflateInit2(&zs_, window_bits) != Z_OK) {
+                errstr_ = "cannot initialize zlib";
+                return false;
+            }
+            initialized_ = true;
+            return true;
         }
     };
+#endif
 
     /**
-     * multipart/form-data request class.
-     * see also RFC 1867.
+     * incremental decoder of the response body framing.
+     * feed() the received bytes, and the decoded body goes to the ResponseHandler.
+     * see also RFC 2616 section 4.4.
      */
-    class RequestFormData : public Request {
+    class BodyReader {
+    public:
+        enum Mode {
+            MODE_NONE,      // HEAD, 1xx, 204, 304
+            MODE_LENGTH,    // Content-Length
+            MODE_CHUNKED,   // Transfer-Encoding: chunked
+            MODE_EOF        // read until the server closes the connection
+        };
     private:
-        enum PartType {
-            PART_STRING,
-            PART_FILE
+        enum ChunkState {
+            CHUNK_SIZE,
+            CHUNK_DATA,
+            CHUNK_DATA_END,
+            CHUNK_TRAILER
         };
-        class PartElement {
-        public:
-            PartElement(PartType type, const std::string &name, const std::string &value) {
-                type_  = type;
-                name_  = name;
-                value_ = value;
-
-                if (type == PART_STRING) {
-                    size_ = value_.size();
-                } else {
-                    // get file length
-                    size_ = 0;
-                    FILE * fp = fopen(value_.c_str(), "r");
-                    if (!fp) {return;}
-                    if (fseek(fp, 0L, SEEK_END) != 0) { return; }
-                    long len = ftell(fp);
-                    if (len == -1) { return; }
-                    if (fclose(fp) != 0) { return; }
-                    size_ = len;
+        Mode mode_;
+        bool done_;
+        size_t remains_;
+        ChunkState chunk_state_;
+        std::string line_;
+    public:
+        BodyReader() {
+            this->init(MODE_EOF);
+        }
+        void init(Mode mode, size_t content_length=0) {
+            mode_        = mode;
+            remains_     = content_length;
+            done_        = mode == MODE_NONE || (mode == MODE_LENGTH && content_length == 0);
+            chunk_state_ = CHUNK_SIZE;
+            line_.clear();
+        }
+        /**
+         * pick the framing mode from the request method and the response headers.
+         */
+        static Mode detect(const std::string &method, Response *res, size_t *content_length) {
+            *content_length = 0;
+            int status = res->status();
+            if (method == "HEAD" || (status >= 100 && status < 200) || status == 204 || status == 304) {
+                return MODE_NONE;
+            }
+            StringRef te = res->find_header("Transfer-Encoding");
+            if (!te.is_null()) {
+                if (te.size() >= 7 && strncasecmp(te.data() + te.size() - 7, "chunked", 7) == 0) {
+                    return MODE_CHUNKED;
                 }
+                return MODE_EOF;
             }
-            inline std::string name() { return name_; }
-            inline std::string value() { return value_; }
-            inline std::string header() { return header_; }
-            inline void push_header(std::string &header) { header_ = header; }
-            inline PartType type() { return type_; }
-            inline size_t size() { return size_; }
-            bool send(nanosocket::Socket &sock, char *buf, size_t buflen) {
-                if (type_ == PART_STRING) {
-                    std::string buf;
-                    buf += this->header();
-                    buf += this->value();
-                    buf += "\r\n";
-                    if (!this->send_all(sock, buf)) {
-                        return false;
+            if (res->find_header("Content-Length").to_size(content_length)) {
+                return MODE_LENGTH;
+            }
+            return MODE_EOF;
+        }
+        inline Mode mode() { return mode_; }
+        inline bool is_done() { return done_; }
+        /// the end of body is known without EOF
+        inline bool is_self_delimited() { return mode_ != MODE_EOF; }
+        /// max bytes we should read from the socket for this body.
+        inline size_t wanted(size_t bufsize) {
+            if (mode_ == MODE_LENGTH) {
+                return std::min(bufsize, remains_);
+            }
+            return bufsize;
+        }
+        /**
+         * bytes which are body data as they are, and can be passed to the
+         * handler without feed(), e.g. by splice(2).
+         * 0 while the chunk header is expected.
+         */
+        inline size_t direct_size() {
+            if (done_) {
+                return 0;
+            }
+            switch (mode_) {
+            case MODE_LENGTH:
+                return remains_;
+            case MODE_EOF:
+                return (size_t)-1;
+            case MODE_CHUNKED:
+                return chunk_state_ == CHUNK_DATA ? remains_ : 0;
+            default:
+                return 0;
+            }
+        }
+        /// n bytes of direct_size() were passed to the handler
+        inline void skip_direct(size_t n) {
+            if (mode_ == MODE_LENGTH) {
+                remains_ -= n;
+                done_ = remains_ == 0;
+            } else if (mode_ == MODE_CHUNKED) {
+                remains_ -= n;
+                if (remains_ == 0) {
+                    chunk_state_ = CHUNK_DATA_END;
+                }
+            }
+        }
+        /**
+         * the server closed the connection.
+         * @return true if it is the valid end of the body
+         */
+        inline bool finish_on_eof() {
+            if (mode_ == MODE_EOF) {
+                done_ = true;
+            }
+            return done_;
+        }
+        /**
+         * @return number of bytes consumed, -1 when the framing is broken,
+         *         or -2 when the handler aborted.
+         * bytes after the end of body are not consumed.
+         */
+        ssize_t feed(const char *buf, size_t len, ResponseHandler *handler) {
+            if (mode_ == MODE_EOF) {
+                return this->emit(handler, buf, len) ? (ssize_t)len : -2;
+            }
+            if (mode_ == MODE_LENGTH) {
+                size_t n = std::min(len, remains_);
+                remains_ -= n;
+                done_ = remains_ == 0;
+                return this->emit(handler, buf, n) ? (ssize_t)n : -2;
+            }
+            if (mode_ == MODE_NONE) {
+                return 0;
+            }
+            return this->feed_chunked(buf, len, handler);
+        }
+        inline ssize_t feed(const char *buf, size_t len, Response *res) {
+            BufferingHandler handler(res);
+            return this->feed(buf, len, &handler);
+        }
+    protected:
+        inline bool emit(ResponseHandler *handler, const char *buf, size_t len) {
+            return len == 0 || handler->on_body(buf, len);
+        }
+        ssize_t feed_chunked(const char *buf, size_t len, ResponseHandler *handler) {
+            size_t pos = 0;
+            while (pos < len && !done_) {
+                if (chunk_state_ == CHUNK_DATA) {
+                    size_t n = std::min(len - pos, remains_);
+                    if (!this->emit(handler, buf + pos, n)) {
+                        return -2;
                     }
-                    return true;
-                } else {
-                    if (!this->send_all(sock, this->header())) {
-                        return false;
+                    pos += n;
+                    remains_ -= n;
+                    if (remains_ == 0) {
+                        chunk_state_ = CHUNK_DATA_END;
                     }
-                    FILE *fp = fopen(value_.c_str(), "rb");
-                    if (!fp) {
-                        return false;
+                    continue;
+                }
+
+                // other states are line oriented
+                const char *nl = (const char*)memchr(buf + pos, '\n', len - pos);
+                if (!nl) {
+                    line_.append(buf + pos, len - pos);
+                    pos = len;
+                    if (line_.size() > 4096) {
+                        return -1; // too long chunk header
                     }
-                    while (!feof(fp)) {
-                        size_t r = fread(buf, sizeof(char), buflen, fp);
-                        if (r == 0) {
-                            break;
-                        }
-                        if (!this->send_all(sock, buf, r)) {
-                            return false;
-                        }
+                    break;
+                }
+                line_.append(buf + pos, nl - (buf + pos));
+                pos = nl - buf + 1;
+                if (!line_.empty() && line_[line_.size()-1] == '\r') {
+                    line_.erase(line_.size()-1);
+                }
+
+                if (chunk_state_ == CHUNK_SIZE) {
+                    char *end;
+                    errno = 0;
+                    unsigned long long size = strtoull(line_.c_str(), &end, 16);
+                    if (end == line_.c_str() || (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t') || errno != 0 || size > (size_t)-1) {
+                        return -1;
                     }
-                    fclose(fp);
-                    if (!this->send_all(sock, "\r\n", sizeof("\r\n")-1)) {
-                        return false;
+                    remains_ = size;
+                    chunk_state_ = size == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+                } else if (chunk_state_ == CHUNK_DATA_END) {
+                    if (!line_.empty()) {
+                        return -1;
                     }
-                    return true;
-                }
-            }
-        private:
-            PartType type_;
-            std::string name_;
-            std::string value_;
-            std::string header_;
-            size_t size_;
-            inline bool send_all(nanosocket::Socket &sock, const char *src, ssize_t srclen) {
-                int remains = srclen;
-                while (remains > 0) {
-                    ssize_t sent = sock.send(src, remains);
-                    if (sent < 0) {
-                        return false;
-                    } else {
-                        remains -= sent;
+                    chunk_state_ = CHUNK_SIZE;
+                } else { // CHUNK_TRAILER. trailers are ignored.
+                    if (line_.empty()) {
+                        done_ = true;
                     }
                 }
-                return true;
-            }
-            inline bool send_all(nanosocket::Socket &sock, const std::string & src) {
-                return this->send_all(sock, src.c_str(), src.size());
+                line_.clear();
             }
-        };
-        std::vector<PartElement> elements_;
-        std::string boundary_;
-        size_t multipart_buffer_size_;
-        char *multipart_buffer_;
-    public:
-        RequestFormData(const char *method, const char *uri):Request(method, uri) {
-            this->Init(method, uri);
-            boundary_ = RequestFormData::generate_boundary(10); // enough randomness
-
-            std::string content_type("multipart/form-data; boundary=\"");
-            content_type += boundary_;
-            content_type += "\"";
-            this->set_header("Content-Type", content_type.c_str());
+            return pos;
+        }
+    };
 
-            content_length_ = 0;
+    /**
+     * seconds on the monotonic clock.
+     */
+    inline double monotonic_time() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+    }
 
-            multipart_buffer_size_ = NANOWWW_DEFAULT_MULTIPART_BUFFER_SIZE;
-            multipart_buffer_ = new char [multipart_buffer_size_];
-            assert(multipart_buffer_);
+    /**
+     * point in time that an I/O operation must finish by.
+     */
+    class Deadline {
+    private:
+        double at_; // < 0 means no deadline
+    public:
+        Deadline() : at_(-1) { }
+        /// deadline after sec. 0 means no deadline.
+        static Deadline after(double sec) {
+            Deadline d;
+            if (sec > 0) {
+                d.at_ = monotonic_time() + sec;
+            }
+            return d;
         }
-        ~RequestFormData() {
-            delete [] multipart_buffer_;
+        /// earlier one of a and b
+        static Deadline min(const Deadline &a, const Deadline &b) {
+            if (a.is_infinite()) { return b; }
+            if (b.is_infinite()) { return a; }
+            return a.at_ < b.at_ ? a : b;
         }
-        void set_multipart_buffer_size(size_t s) {
-            multipart_buffer_size_ = s;
-            delete [] multipart_buffer_;
-            multipart_buffer_ = new char [s];
-            assert(multipart_buffer_);
+        inline bool is_infinite() const { return at_ < 0; }
+        inline bool is_expired() const {
+            return !this->is_infinite() && monotonic_time() >= at_;
         }
-        bool write_content(nanosocket::Socket & sock) {
-            // send each elements
-            std::vector<PartElement>::iterator iter = elements_.begin();
-            for (;iter != elements_.end(); ++iter) {
-                if (!iter->send(sock, multipart_buffer_, multipart_buffer_size_)) {
-                    return false;
-                }
-            }
+        /// remaining time in msec for poll(2). -1 means infinite.
+        inline int remaining_msec() const {
+            if (this->is_infinite()) { return -1; }
+            double rest = at_ - monotonic_time();
+            return rest <= 0 ? 0 : (int)ceil(rest * 1000);
+        }
+    };
 
-            // send terminater
-            std::string buf;
-            buf += std::string("--")+boundary_+"--\r\n";
-            if (!this->send_all(sock, buf)) {
-                return false;
+    class Mutex {
+    private:
+        pthread_mutex_t mutex_;
+        Mutex(const Mutex &);
+        Mutex & operator=(const Mutex &);
+    public:
+        Mutex() { pthread_mutex_init(&mutex_, NULL); }
+        ~Mutex() { pthread_mutex_destroy(&mutex_); }
+        inline void lock() { pthread_mutex_lock(&mutex_); }
+        inline void unlock() { pthread_mutex_unlock(&mutex_); }
+        /// @return true if locked
+        inline bool try_lock() { return pthread_mutex_trylock(&mutex_) == 0; }
+        inline pthread_mutex_t * get() { return &mutex_; }
+    };
+
+    /// locks the mutex in the scope
+    class ScopedLock {
+    private:
+        Mutex &mutex_;
+        ScopedLock(const ScopedLock &);
+        ScopedLock & operator=(const ScopedLock &);
+    public:
+        ScopedLock(Mutex &mutex) : mutex_(mutex) { mutex_.lock(); }
+        ~ScopedLock() { mutex_.unlock(); }
+    };
+
+    /// owns the object, and deletes it at the end of the scope(std::auto_ptr is deprecated)
+    template <class T>
+    class ScopedPtr {
+    private:
+        T *ptr_;
+        ScopedPtr(const ScopedPtr &);
+        ScopedPtr & operator=(const ScopedPtr &);
+    public:
+        explicit ScopedPtr(T *ptr=NULL) : ptr_(ptr) { }
+        ~ScopedPtr() { delete ptr_; }
+        inline T * get() const { return ptr_; }
+        inline T * operator->() const { return ptr_; }
+        inline T & operator*() const { return *ptr_; }
+        inline void reset(T *ptr=NULL) {
+            if (ptr != ptr_) {
+                delete ptr_;
+                ptr_ = ptr;
             }
-            return true;
         }
-        void finalize_header() {
-            std::vector<PartElement>::iterator iter = elements_.begin();
-            for (;iter != elements_.end(); ++iter) {
-                std::string buf;
-                buf += std::string("--")+boundary_+"\r\n";
-                buf += std::string("Content-Disposition: form-data; name=\"")+iter->name()+"\"";
-                if (iter->type() == PART_FILE) {
-                    buf += std::string("; filename=\"");
-                    buf += iter->value()  + "\"";
-                }
-                buf += "\r\n\r\n";
-                iter->push_header(buf);
-                content_length_ += buf.size();
-                content_length_ += iter->size();
-                content_length_ += 2;
-            }
-            content_length_ += sizeof("--")-1+boundary_.size()+sizeof("--\r\n")-1;
+        /// give up the ownership
+        inline T * release() {
+            T *ptr = ptr_;
+            ptr_ = NULL;
+            return ptr;
         }
-        static inline std::string generate_boundary(int n) {
-            srand(time(NULL));
+    };
 
-            std::string sbuf;
-            for (int i=0; i<n*3; i++) {
-                sbuf += (float(rand())/RAND_MAX*256);
+    /// socket address of any family
+    struct Address {
+        struct sockaddr_storage addr;
+        socklen_t len;
+
+        inline const struct sockaddr * sockaddr() const {
+            return (const struct sockaddr *)&addr;
+        }
+        inline int family() const { return addr.ss_family; }
+        inline void set_port(unsigned short port) {
+            if (addr.ss_family == AF_INET) {
+                ((struct sockaddr_in *)&addr)->sin_port = htons(port);
+            } else if (addr.ss_family == AF_INET6) {
+                ((struct sockaddr_in6 *)&addr)->sin6_port = htons(port);
             }
-            int bbufsiz = nb_base64_needed_encoded_length(sbuf.size());
-            unsigned char * bbuf = new unsigned char[bbufsiz];
-            assert(bbuf);
-            nb_base64_encode((const unsigned char*)sbuf.c_str(), sbuf.size(), (unsigned char*)bbuf);
-            std::string ret((char*)bbuf);
-            delete [] bbuf;
-            return ret;
         }
-        inline std::string boundary() { return boundary_; }
-        inline bool add_string(const std::string &name, const std::string &body) {
-            elements_.push_back(PartElement(PART_STRING, name, body));
-            return true;
+        inline unsigned short port() const {
+            if (addr.ss_family == AF_INET) {
+                return ntohs(((const struct sockaddr_in *)&addr)->sin_port);
+            } else if (addr.ss_family == AF_INET6) {
+                return ntohs(((const struct sockaddr_in6 *)&addr)->sin6_port);
+            }
+            return 0;
         }
-        inline bool add_file(const std::string &name, const std::string &fname) {
-            elements_.push_back(PartElement(PART_FILE, name, fname));
-            return true;
+        /// same IP address. port is not compared.
+        inline bool same_host(const Address &other) const {
+            if (this->family() != other.family()) {
+                return false;
+            }
+            if (this->family() == AF_INET) {
+                return memcmp(&((const struct sockaddr_in *)&addr)->sin_addr,
+                              &((const struct sockaddr_in *)&other.addr)->sin_addr, sizeof(struct in_addr)) == 0;
+            } else if (this->family() == AF_INET6) {
+                return memcmp(&((const struct sockaddr_in6 *)&addr)->sin6_addr,
+                              &((const struct sockaddr_in6 *)&other.addr)->sin6_addr, sizeof(struct in6_addr)) == 0;
+            }
+            return false;
         }
     };
 
-    class Client {
-    private:
-        std::string errstr_;
-        unsigned int timeout_;
-        int max_redirects_;
-        nanouri::Uri proxy_url_;
-    public:
-        Client() {
-            timeout_ = 60; // default timeout is 60sec
-            max_redirects_ = 7; // default. same as LWP::UA
+    /**
+     * getaddrinfo(3) for SOCK_STREAM. port of the addresses is 0.
+     * @return 0, or EAI_* error code.
+     */
+    inline int lookup_host(const char *host, std::vector<Address> *addrs, int flags=0) {
+        struct addrinfo hints, *res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags    = flags;
+        int err = getaddrinfo(host, NULL, &hints, &res);
+        if (err != 0) {
+            return err;
         }
-        /**
-         * @args tiemout: timeout in sec.
-         * @return none
-         */
-        inline void set_timeout(unsigned int timeout) {
-            timeout_ = timeout;
+        addrs->clear();
+        for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+            Address a;
+            memset(&a, 0, sizeof(a));
+            memcpy(&a.addr, ai->ai_addr, ai->ai_addrlen);
+            a.len = ai->ai_addrlen;
+            addrs->push_back(a);
         }
-        inline unsigned int timeout() { return timeout_; }
+        freeaddrinfo(res);
+        return 0;
+    }
 
-        /// set proxy url
-        inline bool set_proxy(std::string &proxy_url) {
-            return proxy_url_.parse(proxy_url);
+    /**
+     * thread-safe cache of host name resolution.
+     * share one instance between Clients(and threads) by Client::set_dns_cache().
+     *
+     * getaddrinfo(3) doesn't tell the TTL of the records, so the entries live
+     * for ttl() sec, and failures for negative_ttl() sec.
+     * with set_prefetch(true), a hit in the last quarter of the TTL refreshes
+     * the entry in a background thread, so the hot names never expire.
+     * entries loaded by load_hosts() never expire.
+     *
+     * override lookup() to use another resolver. such subclass must call
+     * stop_prefetch_thread() in its destructor.
+     */
+    class DNSCache {
+    public:
+        struct Stats {
+            unsigned long hits;
+            unsigned long misses;
+            unsigned long negative_hits; // hits of cached failures, included in hits
+            unsigned long prefetches;
+        };
+    private:
+        struct Entry {
+            std::vector<Address> addrs;
+            int error;
+            double expires; // < 0 means never
+            bool refreshing;
+        };
+        Mutex mutex_;
+        std::map<std::string, Entry> entries_;
+        double ttl_;
+        double negative_ttl_;
+        size_t max_entries_;
+        bool prefetch_;
+        Stats stats_;
+        // prefetch thread
+        pthread_t thread_;
+        bool thread_started_;
+        bool stopping_;
+        pthread_cond_t cond_;
+        std::list<std::string> queue_;
+        DNSCache(const DNSCache &);
+        DNSCache & operator=(const DNSCache &);
+    public:
+        DNSCache() {
+            ttl_ = NANOWWW_DNS_TTL;
+            negative_ttl_ = NANOWWW_DNS_NEGATIVE_TTL;
+            max_entries_ = NANOWWW_DNS_MAX_ENTRIES;
+            prefetch_ = false;
+            memset(&stats_, 0, sizeof(stats_));
+            thread_started_ = false;
+            stopping_ = false;
+            pthread_cond_init(&cond_, NULL);
         }
-        /// get proxy url
-        inline std::string proxy() {
-            return proxy_url_.as_string();
+        virtual ~DNSCache() {
+            this->stop_prefetch_thread();
+            pthread_cond_destroy(&cond_);
         }
-        inline bool is_proxy() {
-            return proxy_url_;
+        /// lifetime of the resolved entries in sec
+        inline void set_ttl(double ttl) { ScopedLock lock(mutex_); ttl_ = ttl; }
+        inline double ttl() { ScopedLock lock(mutex_); return ttl_; }
+        /// lifetime of the failures in sec. 0 disables negative caching.
+        inline void set_negative_ttl(double ttl) { ScopedLock lock(mutex_); negative_ttl_ = ttl; }
+        inline double negative_ttl() { ScopedLock lock(mutex_); return negative_ttl_; }
+        inline void set_max_entries(size_t n) { ScopedLock lock(mutex_); max_entries_ = n; }
+        /// refresh the entries before they expire, in a background thread.
+        inline void set_prefetch(bool prefetch) { ScopedLock lock(mutex_); prefetch_ = prefetch; }
+        inline Stats stats() { ScopedLock lock(mutex_); return stats_; }
+        inline size_t size() { ScopedLock lock(mutex_); return entries_.size(); }
+        void clear() {
+            ScopedLock lock(mutex_);
+            entries_.clear();
         }
+
         /**
-         * @return string of latest error
+         * addresses of host:port, from the cache if possible.
+         * @return false on error(*errstr is set).
          */
-        inline std::string errstr() { return errstr_; }
-        inline int send_get(Response *res, const std::string &uri) {
-            return this->send_get(res, uri.c_str());
-        }
-        inline int send_get(Response *res, const char *uri) {
-            Request req("GET", uri, "");
+        bool resolve(const char *host, unsigned short port, std::vector<Address> *addrs, std::string *errstr) {
+            std::string key(host);
+            int error = 0;
+            bool found = false;
+            {
+                ScopedLock lock(mutex_);
+                std::map<std::string, Entry>::iterator iter = entries_.find(key);
+                double now = monotonic_time();
+                if (iter != entries_.end() && (iter->second.expires < 0 || now < iter->second.expires)) {
+                    Entry &e = iter->second;
+                    found = true;
+                    error = e.error;
+                    *addrs = e.addrs;
+                    ++stats_.hits;
+                    if (error != 0) {
+                        ++stats_.negative_hits;
+                    } else if (prefetch_ && e.expires >= 0 && !e.refreshing
+                            && e.expires - now < ttl_ / 4) {
+                        e.refreshing = true;
+                        queue_.push_back(key);
+                        ++stats_.prefetches;
+                        this->start_prefetch_thread();
+                        pthread_cond_signal(&cond_);
+                    }
+                } else {
+                    ++stats_.misses;
+                }
+            }
+            if (!found) {
+                // *addrs may hold the addresses of another host. don't cache them on failure.
+                std::vector<Address> resolved;
+                error = this->lookup(key, &resolved);
+                if (error != 0) {
+                    resolved.clear();
+                }
+                this->store(key, error, resolved);
+                addrs->swap(resolved);
+            }
+            if (error != 0) {
+                *errstr = gai_strerror(error);
+                return false;
+            }
+            for (size_t i=0; i<addrs->size(); i++) {
+                (*addrs)[i].set_port(port);
+            }
+            return true;
+        }
+
+        /**
+         * load /etc/hosts style file("address name [aliases...]") as the
+         * entries never expire. they replace the entries of the last load.
+         * @return false if the file cannot be read.
+         */
+        bool load_hosts(const char *path) {
+            FILE *fp = fopen(path, "r");
+            if (!fp) {
+                return false;
+            }
+            std::map<std::string, std::vector<Address> > hosts;
+            char line[1024];
+            while (fgets(line, sizeof(line), fp)) {
+                char *hash = strchr(line, '#');
+                if (hash) { *hash = '\0'; }
+                std::istringstream iss(line);
+                std::string addr, name;
+                std::vector<Address> addrs;
+                if (!(iss >> addr) || lookup_host(addr.c_str(), &addrs, AI_NUMERICHOST) != 0) {
+                    continue;
+                }
+                while (iss >> name) {
+                    std::vector<Address> &v = hosts[name];
+                    v.insert(v.end(), addrs.begin(), addrs.end());
+                }
+            }
+            fclose(fp);
+
+            ScopedLock lock(mutex_);
+            std::map<std::string, Entry>::iterator iter = entries_.begin();
+            while (iter != entries_.end()) {
+                if (iter->second.expires < 0) {
+                    entries_.erase(iter++);
+                } else {
+                    ++iter;
+                }
+            }
+            std::map<std::string, std::vector<Address> >::iterator h = hosts.begin();
+            for (; h != hosts.end(); ++h) {
+                Entry &e = entries_[h->first];
+                e.addrs.swap(h->second);
+                e.error = 0;
+                e.expires = -1;
+                e.refreshing = false;
+            }
+            return true;
+        }
+    protected:
+        /**
+         * resolve the host without the cache. called without the lock.
+         * @return 0, or EAI_* error code.
+         */
+        virtual int lookup(const std::string &host, std::vector<Address> *addrs) {
+            return lookup_host(host.c_str(), addrs);
+        }
+        void store(const std::string &key, int error, const std::vector<Address> &addrs) {
+            ScopedLock lock(mutex_);
+            std::map<std::string, Entry>::iterator iter = entries_.find(key);
+            if (iter != entries_.end() && iter->second.expires < 0) {
+                return; // static entry
+            }
+            double ttl = error == 0 ? ttl_ : negative_ttl_;
+            if (ttl <= 0) {
+                if (iter != entries_.end()) { entries_.erase(iter); }
+                return;
+            }
+            if (iter == entries_.end()) {
+                if (entries_.size() >= max_entries_) {
+                    this->expire();
+                }
+                iter = entries_.insert(std::make_pair(key, Entry())).first;
+            }
+            Entry &e = iter->second;
+            e.addrs = addrs;
+            e.error = error;
+            e.expires = monotonic_time() + ttl;
+            e.refreshing = false;
+        }
+        /// remove expired entries. if still full, drop some anyway.
+        void expire() {
+            double now = monotonic_time();
+            std::map<std::string, Entry>::iterator iter = entries_.begin();
+            while (iter != entries_.end()) {
+                if (iter->second.expires >= 0 && iter->second.expires <= now) {
+                    entries_.erase(iter++);
+                } else {
+                    ++iter;
+                }
+            }
+            iter = entries_.begin();
+            while (entries_.size() >= max_entries_ && iter != entries_.end()) {
+                if (iter->second.expires >= 0) {
+                    entries_.erase(iter++);
+                } else {
+                    ++iter;
+                }
+            }
+        }
+        void start_prefetch_thread() {
+            if (!thread_started_) {
+                thread_started_ = pthread_create(&thread_, NULL, DNSCache::prefetch_main, this) == 0;
+            }
+        }
+        void stop_prefetch_thread() {
+            {
+                ScopedLock lock(mutex_);
+                if (!thread_started_) {
+                    return;
+                }
+                stopping_ = true;
+                pthread_cond_signal(&cond_);
+            }
+            pthread_join(thread_, NULL);
+        }
+        static void * prefetch_main(void *arg) {
+            DNSCache *self = (DNSCache *)arg;
+            while (1) {
+                std::string host;
+                {
+                    ScopedLock lock(self->mutex_);
+                    while (self->queue_.empty() && !self->stopping_) {
+                        pthread_cond_wait(&self->cond_, self->mutex_.get());
+                    }
+                    if (self->stopping_) {
+                        return NULL;
+                    }
+                    host = self->queue_.front();
+                    self->queue_.pop_front();
+                }
+                std::vector<Address> addrs;
+                int error = self->lookup(host, &addrs);
+                if (error == 0) {
+                    self->store(host, error, addrs);
+                } else { // keep the current addresses until they expire
+                    ScopedLock lock(self->mutex_);
+                    std::map<std::string, Entry>::iterator iter = self->entries_.find(host);
+                    if (iter != self->entries_.end()) {
+                        iter->second.refreshing = false;
+                    }
+                }
+            }
+        }
+    };
+
+    /**
+     * TCP connection with non-blocking I/O.
+     * each send/recv waits by poll(2) until the deadline, so timeouts don't
+     * depend on the process-wide SIGALRM and work in any thread.
+     * on timeout, the operation fails with errno == ETIMEDOUT.
+     *
+     * try_*() methods never wait. they are the building blocks for event loops
+     * like MultiClient: on EAGAIN, *events tells what to wait for.
+     */
+    class Connection : public nanosocket::Socket {
+    protected:
+        /// connection attempt of connect_any()
+        struct Attempt {
+            int fd;
+            size_t index;
+            double expires; // < 0 means no limit
+        };
+        Deadline deadline_;
+        DNSCache *dns_cache_;
+        double attempt_delay_;
+        double attempt_timeout_;
+        Address preferred_;
+        bool has_preferred_;
+        Address peer_;
+        Response::Timing *timing_;
+        int pipe_[2]; // for splice_to()
+    public:
+        Connection() : dns_cache_(NULL), has_preferred_(false), timing_(NULL) {
+            attempt_delay_ = NANOWWW_CONNECTION_ATTEMPT_DELAY / 1000.0;
+            attempt_timeout_ = 0;
+            memset(&peer_, 0, sizeof(peer_));
+            pipe_[0] = pipe_[1] = -1;
+        }
+        virtual ~Connection() {
+            this->close_pipe();
+        }
+        /// deadline for the following I/O operations
+        inline void set_deadline(const Deadline &deadline) { deadline_ = deadline; }
+        inline const Deadline & deadline() const { return deadline_; }
+        virtual bool is_tls() { return false; }
+        inline void set_errstr(const std::string &errstr) { errstr_ = errstr; }
+
+        /// resolve host names through the cache. NULL means getaddrinfo(3) every time.
+        inline void set_dns_cache(DNSCache *cache) { dns_cache_ = cache; }
+
+        /**
+         * resolve host:port for SOCK_STREAM.
+         * @return false on error
+         */
+        bool resolve(const char *host, short port, std::vector<Address> *addrs) {
+            if (dns_cache_) {
+                return dns_cache_->resolve(host, port, addrs, &errstr_);
+            }
+            int err = lookup_host(host, addrs);
+            if (err != 0) {
+                errstr_ = gai_strerror(err);
+                return false;
+            }
+            for (size_t i=0; i<addrs->size(); i++) {
+                (*addrs)[i].set_port(port);
+            }
+            return true;
+        }
+
+        /**
+         * settings of connect_any().
+         * delay: start the next address if the current attempt doesn't finish in this sec.
+         * timeout: give up each attempt after this sec. 0 means only the deadline.
+         */
+        inline void set_attempt_delay(double delay) { attempt_delay_ = delay; }
+        inline void set_attempt_timeout(double timeout) { attempt_timeout_ = timeout; }
+        /// try this address first, e.g. the winner of the last connect.
+        inline void set_preferred_address(const Address &addr) {
+            preferred_ = addr;
+            has_preferred_ = true;
+        }
+        /// the address connected to
+        inline const Address & peer_address() const { return peer_; }
+        /**
+         * record the connect phases and the bytes to this, if the binary is
+         * built with -DNANOWWW_ENABLE_TIMING. NULL stops recording.
+         */
+        inline void set_timing(Response::Timing *timing) { timing_ = timing; }
+
+        /**
+         * connect to the host and finish the handshake, until the deadline.
+         * the addresses are raced by connect_any().
+         */
+        virtual bool connect(const char *host, short port) {
+            std::vector<Address> addrs;
+            if (!this->resolve(host, port, &addrs)) {
+                return false;
+            }
+            this->mark(&Response::Timing::dns_done);
+            this->sort_addresses(&addrs);
+            if (!this->connect_any(addrs)) {
+                return false;
+            }
+            this->mark(&Response::Timing::connect_done);
+            if (!this->handshake(host)) {
+                return false;
+            }
+            if (this->is_tls()) {
+                this->mark(&Response::Timing::tls_done);
+            }
+            return true;
+        }
+        /**
+         * order the addresses for connect_any(): interleave the families,
+         * starting with the first one of the resolver(RFC 8305 section 4).
+         * the preferred address goes first.
+         */
+        void sort_addresses(std::vector<Address> *addrs) {
+            if (addrs->empty()) {
+                return;
+            }
+            int first_family = (*addrs)[0].family();
+            std::vector<Address> first, second, sorted;
+            for (size_t i=0; i<addrs->size(); i++) {
+                if (has_preferred_ && (*addrs)[i].same_host(preferred_)) {
+                    sorted.push_back((*addrs)[i]);
+                } else if ((*addrs)[i].family() == first_family) {
+                    first.push_back((*addrs)[i]);
+                } else {
+                    second.push_back((*addrs)[i]);
+                }
+            }
+            for (size_t i=0; i<first.size() || i<second.size(); i++) {
+                if (i < first.size())  { sorted.push_back(first[i]); }
+                if (i < second.size()) { sorted.push_back(second[i]); }
+            }
+            addrs->swap(sorted);
+        }
+        /**
+         * connect to one of the addresses, until the deadline("Happy Eyeballs", RFC 8305).
+         * the attempts are started in order, one per attempt delay, or at
+         * once when the previous one failed. the first established connection
+         * wins and the others are closed.
+         */
+        bool connect_any(const std::vector<Address> &addrs) {
+            if (fd_ != -1) {
+                this->close();
+            }
+            std::vector<Attempt> attempts;
+            std::vector<struct pollfd> pfds;
+            size_t next = 0;
+            double next_start = 0;
+            std::string last_error = "no address to connect";
+            int winner = -1;
+            while (winner == -1) {
+                double now = monotonic_time();
+                if (deadline_.is_expired()) {
+                    last_error = strerror(ETIMEDOUT);
+                    errno = ETIMEDOUT;
+                    break;
+                }
+                if (next < addrs.size() && (attempts.empty() || now >= next_start)) {
+                    int fd;
+                    int ret = Connection::open_connect(addrs[next].sockaddr(), addrs[next].len, &fd);
+                    if (ret == 1) {
+                        peer_ = addrs[next];
+                        winner = fd;
+                    } else if (ret == 0) {
+                        Attempt a;
+                        a.fd = fd;
+                        a.index = next;
+                        a.expires = attempt_timeout_ > 0 ? now + attempt_timeout_ : -1;
+                        attempts.push_back(a);
+                        next_start = now + attempt_delay_;
+                    } else {
+                        last_error = strerror(errno);
+                    }
+                    ++next;
+                    continue;
+                }
+                if (attempts.empty()) {
+                    break; // all failed
+                }
+
+                // wait for any attempt, until the next event
+                int timeout = deadline_.remaining_msec();
+                if (next < addrs.size()) {
+                    timeout = Connection::min_msec(timeout, next_start - now);
+                }
+                pfds.resize(attempts.size());
+                for (size_t i=0; i<attempts.size(); i++) {
+                    pfds[i].fd      = attempts[i].fd;
+                    pfds[i].events  = POLLOUT;
+                    pfds[i].revents = 0;
+                    if (attempts[i].expires >= 0) {
+                        timeout = Connection::min_msec(timeout, attempts[i].expires - now);
+                    }
+                }
+                int ret = poll(&pfds[0], pfds.size(), timeout);
+                if (ret < 0 && errno != EINTR) {
+                    last_error = strerror(errno);
+                    break;
+                }
+                now = monotonic_time();
+                std::vector<Attempt> running;
+                for (size_t i=0; i<attempts.size(); i++) {
+                    Attempt &a = attempts[i];
+                    if (ret > 0 && pfds[i].revents && winner == -1) {
+                        int so_error = 0;
+                        socklen_t len = sizeof(so_error);
+                        if (getsockopt(a.fd, SOL_SOCKET, SO_ERROR, &so_error, &len) == 0 && so_error == 0) {
+                            peer_ = addrs[a.index];
+                            winner = a.fd;
+                            continue;
+                        }
+                        last_error = strerror(so_error ? so_error : errno);
+                        ::close(a.fd);
+                    } else if (winner == -1 && (a.expires < 0 || now < a.expires)) {
+                        running.push_back(a);
+                    } else {
+                        if (winner == -1) {
+                            last_error = strerror(ETIMEDOUT);
+                        }
+                        ::close(a.fd);
+                    }
+                }
+                if (running.size() < attempts.size()) {
+                    next_start = now; // an attempt failed. start the next one at once
+                }
+                attempts.swap(running);
+            }
+            for (size_t i=0; i<attempts.size(); i++) {
+                ::close(attempts[i].fd);
+            }
+            if (winner == -1) {
+                errstr_ = last_error;
+                return false;
+            }
+            fd_ = winner;
+            return true;
+        }
+        /// connect to the address, until the deadline
+        bool connect_addr(const struct sockaddr *addr, socklen_t addrlen) {
+            int ret = this->start_connect(addr, addrlen);
+            if (ret == 0) {
+                if (!this->wait(POLLOUT)) {
+                    errstr_ = strerror(errno);
+                    this->close();
+                    return false;
+                }
+                return this->finish_connect();
+            }
+            return ret == 1;
+        }
+        /// take the fd of a socket created elsewhere
+        bool adopt(int fd) {
+            if (fd_ != -1) {
+                this->close();
+            }
+            fd_ = fd;
+            fcntl(fd_, F_SETFD, FD_CLOEXEC);
+            int opt = 1;
+            return this->setsockopt(IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(int)) == 0;
+        }
+        /**
+         * start connecting to the address without waiting.
+         * @return 1 if connected, 0 if in progress(wait for POLLOUT and call
+         *         finish_connect()), -1 on error.
+         */
+        int start_connect(const struct sockaddr *addr, socklen_t addrlen) {
+            if (fd_ != -1) {
+                this->close();
+            }
+            int ret = Connection::open_connect(addr, addrlen, &fd_);
+            if (ret < 0) {
+                errstr_ = strerror(errno);
+            } else {
+                memset(&peer_, 0, sizeof(peer_));
+                memcpy(&peer_.addr, addr, addrlen);
+                peer_.len = addrlen;
+            }
+            return ret;
+        }
+        /// @return true if the connection in progress has been established
+        bool finish_connect() {
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
+            if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &so_error, &len) == -1 || so_error != 0) {
+                errstr_ = strerror(so_error ? so_error : errno);
+                this->close();
+                return false;
+            }
+            return true;
+        }
+        /**
+         * prepare the protocol handshake over the connected socket(TLS).
+         * plain TCP has nothing to do.
+         */
+        virtual bool start_handshake(const char *host) { (void)host; return true; }
+        /**
+         * step the handshake without waiting.
+         * @return 1 if done, 0 if *events should be waited, -1 on error.
+         */
+        virtual int try_handshake(short *events) { (void)events; return 1; }
+        /// run the handshake until the deadline
+        bool handshake(const char *host) {
+            if (!this->start_handshake(host)) {
+                return false;
+            }
+            while (1) {
+                short events;
+                int ret = this->try_handshake(&events);
+                if (ret == 1) {
+                    return true;
+                }
+                if (ret < 0 || !this->wait(events)) {
+                    if (errno == ETIMEDOUT) {
+                        errstr_ = strerror(errno);
+                    }
+                    return false;
+                }
+            }
+        }
+        /**
+         * send without waiting.
+         * @return bytes sent, or -1. if errno is EAGAIN, wait for *events and retry.
+         */
+        virtual ssize_t try_send(const char *buf, size_t len, short *events) {
+            while (1) {
+                ssize_t sent = ::send(fd_, buf, len, NANOWWW_SEND_FLAGS);
+                if (sent < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (sent < 0 && errno == EWOULDBLOCK) {
+                    errno = EAGAIN;
+                }
+                *events = POLLOUT;
+                return sent;
+            }
+        }
+        /**
+         * recv without waiting.
+         * @return bytes received, 0 on EOF, or -1. if errno is EAGAIN, wait for *events and retry.
+         */
+        virtual ssize_t try_recv(char *buf, size_t len, short *events) {
+            while (1) {
+                ssize_t nread = ::recv(fd_, buf, len, 0);
+                if (nread < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (nread < 0 && errno == EWOULDBLOCK) {
+                    errno = EAGAIN;
+                }
+                *events = POLLIN;
+                return nread;
+            }
+        }
+        /**
+         * gathering version of try_send().
+         * @return bytes sent, or -1. if errno is EAGAIN, wait for *events and retry.
+         */
+        virtual ssize_t try_sendv(const struct iovec *iov, int iovcnt, short *events) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov    = const_cast<struct iovec*>(iov);
+            msg.msg_iovlen = iovcnt;
+            while (1) {
+                ssize_t sent = ::sendmsg(fd_, &msg, NANOWWW_SEND_FLAGS);
+                if (sent < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (sent < 0 && errno == EWOULDBLOCK) {
+                    errno = EAGAIN;
+                }
+                *events = POLLOUT;
+                return sent;
+            }
+        }
+        /**
+         * send all of the iovecs, until the deadline.
+         * iov is consumed(modified) while sending.
+         */
+        bool sendv_all(struct iovec *iov, int iovcnt) {
+            while (iovcnt > 0) {
+                if (iov->iov_len == 0) {
+                    ++iov; --iovcnt;
+                    continue;
+                }
+                short events;
+                ssize_t sent = this->try_sendv(iov, iovcnt, &events);
+                this->count_sent(sent);
+                if (sent < 0) {
+                    if (errno != EAGAIN || !this->wait(events)) {
+                        return false;
+                    }
+                    continue;
+                }
+                if (sent == 0) {
+                    return false;
+                }
+                while (sent > 0 && (size_t)sent >= iov->iov_len) {
+                    sent -= iov->iov_len;
+                    ++iov; --iovcnt;
+                }
+                if (sent > 0) {
+                    iov->iov_base = (char*)iov->iov_base + sent;
+                    iov->iov_len -= sent;
+                }
+            }
+            return true;
+        }
+        virtual int send(const char *buf, size_t len) {
+            while (1) {
+                short events;
+                ssize_t sent = this->try_send(buf, len, &events);
+                this->count_sent(sent);
+                if (sent >= 0 || errno != EAGAIN) {
+                    return sent;
+                }
+                if (!this->wait(events)) {
+                    return -1;
+                }
+            }
+        }
+        virtual int recv(char *buf, size_t len) {
+            while (1) {
+                short events;
+                ssize_t nread = this->try_recv(buf, len, &events);
+                this->count_received(nread);
+                if (nread >= 0 || errno != EAGAIN) {
+                    return nread;
+                }
+                if (!this->wait(events)) {
+                    return -1;
+                }
+            }
+        }
+        /**
+         * send count bytes of the file from *offset by sendfile(2), until the deadline.
+         * the file position of in_fd is not changed.
+         * @return bytes sent, or -1. errno is EINVAL or ENOSYS if sendfile(2)
+         *         can't be used for this file/socket. then copy it yourself.
+         */
+        virtual ssize_t send_file(int in_fd, off_t *offset, size_t count) {
+#ifdef __linux__
+            size_t total = 0;
+            while (total < count) {
+                ssize_t sent = ::sendfile(fd_, in_fd, offset, count - total);
+                this->count_sent(sent);
+                if (sent > 0) {
+                    total += sent;
+                    continue;
+                }
+                if (sent == 0) { // file is shorter than expected
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    return total > 0 ? (ssize_t)total : -1;
+                }
+                if (!this->wait(POLLOUT)) {
+                    return -1;
+                }
+            }
+            return total;
+#else
+            (void)in_fd; (void)offset; (void)count;
+            errno = ENOSYS;
+            return -1;
+#endif
+        }
+        /**
+         * move up to len bytes from the socket into out_fd by splice(2) through
+         * a pipe, without copying them to userspace. waits until the deadline.
+         * @args offset: file offset of out_fd, advanced. NULL for the current position.
+         * @return bytes moved, 0 on EOF, or -1. errno is EINVAL or ENOSYS if
+         *         splice(2) can't be used(e.g. TLS). then read it yourself.
+         */
+        virtual ssize_t splice_to(int out_fd, off_t *offset, size_t len) {
+#ifdef __linux__
+            int flags = fcntl(out_fd, F_GETFL);
+            if (flags == -1 || (flags & O_APPEND)) { // splice(2) refuses O_APPEND
+                errno = EINVAL;
+                return -1;
+            }
+            if (pipe_[0] == -1) {
+                if (pipe(pipe_) != 0) {
+                    pipe_[0] = pipe_[1] = -1;
+                    return -1;
+                }
+                fcntl(pipe_[0], F_SETFD, FD_CLOEXEC);
+                fcntl(pipe_[1], F_SETFD, FD_CLOEXEC);
+#ifdef F_SETPIPE_SZ
+                fcntl(pipe_[1], F_SETPIPE_SZ, NANOWWW_SPLICE_SIZE); // best effort
+#endif
+            }
+            ssize_t n;
+            while (1) {
+                n = ::splice(fd_, NULL, pipe_[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                this->count_received(n);
+                if (n >= 0) {
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                if ((errno != EAGAIN && errno != EWOULDBLOCK) || !this->wait(POLLIN)) {
+                    return -1;
+                }
+            }
+            // drain the pipe. the data is lost on error, so the pipe is recreated.
+            for (ssize_t moved = 0; moved < n; ) {
+                loff_t off = offset ? *offset : 0;
+                ssize_t m = ::splice(pipe_[0], NULL, out_fd, offset ? &off : NULL, n - moved, SPLICE_F_MOVE);
+                if (m <= 0) {
+                    if (m < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    int err = m < 0 ? errno : EIO;
+                    this->close_pipe();
+                    errno = err == EINVAL ? EIO : err; // EINVAL is for the fallback
+                    return -1;
+                }
+                if (offset) {
+                    *offset = off;
+                }
+                moved += m;
+            }
+            return n;
+#else
+            (void)out_fd; (void)offset; (void)len;
+            errno = ENOSYS;
+            return -1;
+#endif
+        }
+    protected:
+        void close_pipe() {
+            if (pipe_[0] != -1) {
+                ::close(pipe_[0]);
+                ::close(pipe_[1]);
+                pipe_[0] = pipe_[1] = -1;
+            }
+        }
+        /**
+         * create a non-blocking socket and start connecting.
+         * @return same as start_connect(). *fd is -1 on error(errno is set).
+         */
+        static int open_connect(const struct sockaddr *addr, socklen_t addrlen, int *fd) {
+            *fd = ::socket(addr->sa_family, SOCK_STREAM, 0);
+            if (*fd == -1) {
+                return -1;
+            }
+            fcntl(*fd, F_SETFD, FD_CLOEXEC);
+            int opt = 1;
+#ifdef SO_NOSIGPIPE
+            ::setsockopt(*fd, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(int));
+#endif
+            if (fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) | O_NONBLOCK) == -1
+                    || ::setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(int)) == -1) {
+                int err = errno;
+                ::close(*fd);
+                *fd = -1;
+                errno = err;
+                return -1;
+            }
+            if (::connect(*fd, addr, addrlen) == 0) {
+                return 1;
+            }
+            if (errno != EINPROGRESS) {
+                int err = errno;
+                ::close(*fd);
+                *fd = -1;
+                errno = err;
+                return -1;
+            }
+            return 0;
+        }
+        /// record the time of the phase. no-op unless NANOWWW_ENABLE_TIMING.
+        inline void mark(double Response::Timing::*phase) {
+#ifdef NANOWWW_ENABLE_TIMING
+            if (timing_) { timing_->*phase = monotonic_time(); }
+#else
+            (void)phase;
+#endif
+        }
+        inline void count_sent(ssize_t sent) {
+#ifdef NANOWWW_ENABLE_TIMING
+            if (timing_ && sent > 0) { timing_->bytes_sent += sent; }
+#else
+            (void)sent;
+#endif
+        }
+        /// one recv call, returned nread
+        inline void count_received(ssize_t nread) {
+#ifdef NANOWWW_ENABLE_TIMING
+            if (timing_) {
+                ++timing_->recv_calls;
+                if (nread > 0) { timing_->bytes_received += nread; }
+            }
+#else
+            (void)nread;
+#endif
+        }
+        /// smaller one of poll(2) timeouts. sec is rounded up to msec.
+        static int min_msec(int msec, double sec) {
+            int b = sec <= 0 ? 0 : (int)ceil(sec * 1000);
+            return msec < 0 || b < msec ? b : msec;
+        }
+        /**
+         * wait until the socket is ready for events.
+         * @return false on timeout(errno is ETIMEDOUT) or error.
+         */
+        bool wait(short events) {
+            struct pollfd pfd;
+            pfd.fd     = fd_;
+            pfd.events = events;
+            while (1) {
+                pfd.revents = 0;
+                int ret = poll(&pfd, 1, deadline_.remaining_msec());
+                if (ret > 0) {
+                    return true;
+                } else if (ret == 0) {
+                    errno = ETIMEDOUT;
+                    return false;
+                } else if (errno != EINTR) {
+                    return false;
+                }
+            }
+        }
+    };
+
+#ifdef HAVE_SSL
+    /**
+     * SSL_CTX shared by TLSConnections, with the client session cache.
+     * the sessions(session IDs or tickets) are kept per host:port, and the
+     * next handshake to the same server resumes it.
+     * thread-safe. it must outlive the connections.
+     */
+    class TLSContext {
+    public:
+        struct Stats {
+            unsigned long full_handshakes;
+            unsigned long resumed_handshakes;
+        };
+    private:
+        SSL_CTX *ctx_;
+        Mutex mutex_;
+        std::map<std::string, SSL_SESSION*> sessions_;
+        std::deque<std::string> order_; // keys of sessions_, the oldest first
+        Stats stats_;
+        TLSContext(const TLSContext &);
+        TLSContext & operator=(const TLSContext &);
+    public:
+        TLSContext() {
+            memset(&stats_, 0, sizeof(stats_));
+            ctx_ = SSL_CTX_new(SSLv23_client_method());
+            if (ctx_) {
+                SSL_CTX_set_app_data(ctx_, this);
+                // keep the sessions by ourselves, keyed by the server
+                SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+                SSL_CTX_sess_set_new_cb(ctx_, TLSContext::on_new_session);
+            }
+        }
+        ~TLSContext() {
+            this->clear();
+            if (ctx_) {
+                SSL_CTX_free(ctx_);
+            }
+        }
+        inline SSL_CTX * ctx() { return ctx_; }
+        inline Stats stats() { ScopedLock lock(mutex_); return stats_; }
+        /// forget the sessions
+        void clear() {
+            ScopedLock lock(mutex_);
+            std::map<std::string, SSL_SESSION*>::iterator iter = sessions_.begin();
+            for (; iter != sessions_.end(); ++iter) {
+                SSL_SESSION_free(iter->second);
+            }
+            sessions_.clear();
+            order_.clear();
+        }
+        /**
+         * make SSL object for the server.
+         * key must be alive until SSL_free(): new sessions are stored with it.
+         */
+        SSL * new_ssl(const std::string *key) {
+            if (!ctx_) {
+                return NULL;
+            }
+            SSL *ssl = SSL_new(ctx_);
+            if (!ssl) {
+                return NULL;
+            }
+            SSL_set_app_data(ssl, (void*)key);
+            ScopedLock lock(mutex_);
+            std::map<std::string, SSL_SESSION*>::iterator iter = sessions_.find(*key);
+            if (iter != sessions_.end()) {
+                SSL_set_session(ssl, iter->second);
+            }
+            return ssl;
+        }
+        /// count the finished handshake
+        void on_handshake(SSL *ssl) {
+            ScopedLock lock(mutex_);
+            if (SSL_session_reused(ssl)) {
+                ++stats_.resumed_handshakes;
+            } else {
+                ++stats_.full_handshakes;
+            }
+        }
+    protected:
+        /// called by OpenSSL when the server gave a session(TLS 1.3 may send it after the handshake)
+        static int on_new_session(SSL *ssl, SSL_SESSION *session) {
+            TLSContext *self = (TLSContext *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+            const std::string *key = (const std::string *)SSL_get_app_data(ssl);
+            if (!self || !key) {
+                return 0;
+            }
+            ScopedLock lock(self->mutex_);
+            if (!self->sessions_.count(*key)) {
+                if (self->sessions_.size() >= NANOWWW_TLS_MAX_SESSIONS) { // forget the oldest server
+                    std::map<std::string, SSL_SESSION*>::iterator oldest = self->sessions_.find(self->order_.front());
+                    SSL_SESSION_free(oldest->second);
+                    self->sessions_.erase(oldest);
+                    self->order_.pop_front();
+                }
+                self->order_.push_back(*key);
+            }
+            SSL_SESSION *&slot = self->sessions_[*key];
+            if (slot) {
+                SSL_SESSION_free(slot);
+            }
+            slot = session;
+            return 1; // we hold the reference
+        }
+    };
+
+    /**
+     * TLS over Connection. handshake and I/O follow the deadline, too.
+     * the certificate is not verified, same as nanosocket::SSLSocket.
+     * with TLSContext, the SSL_CTX and the sessions are shared.
+     */
+    class TLSConnection : public Connection {
+    protected:
+        SSL_CTX *ctx_; // owned, if shared_ is NULL
+        SSL *ssl_;
+        TLSContext *shared_;
+        std::string session_key_;
+    public:
+        TLSConnection(TLSContext *shared=NULL) : ctx_(NULL), ssl_(NULL), shared_(shared) { }
+        virtual ~TLSConnection() {
+            this->close();
+        }
+        virtual bool is_tls() { return true; }
+        virtual ssize_t send_file(int in_fd, off_t *offset, size_t count) {
+            (void)in_fd; (void)offset; (void)count;
+            errno = EINVAL; // data must be encrypted in userspace
+            return -1;
+        }
+        virtual ssize_t splice_to(int out_fd, off_t *offset, size_t len) {
+            (void)out_fd; (void)offset; (void)len;
+            errno = EINVAL; // data must be decrypted in userspace
+            return -1;
+        }
+        virtual bool start_handshake(const char *host) {
+            if (shared_) {
+                std::ostringstream key;
+                key << host << ":" << peer_.port();
+                session_key_ = key.str();
+                ssl_ = shared_->new_ssl(&session_key_);
+            } else {
+                ctx_ = SSL_CTX_new(SSLv23_client_method());
+                if (!ctx_) {
+                    errstr_ = "cannot create SSL context";
+                    return false;
+                }
+                ssl_ = SSL_new(ctx_);
+            }
+            if (!ssl_ || !SSL_set_fd(ssl_, fd_)) {
+                errstr_ = "cannot create SSL object";
+                return false;
+            }
+            SSL_set_tlsext_host_name(ssl_, host);
+            return true;
+        }
+        virtual int try_handshake(short *events) {
+            int ret = SSL_connect(ssl_);
+            if (ret == 1) {
+                if (shared_) {
+                    shared_->on_handshake(ssl_);
+                }
+                return 1;
+            }
+            if (!this->want(ret, events)) {
+                errstr_ = "SSL handshake failed";
+                return -1;
+            }
+            return 0;
+        }
+        virtual ssize_t try_send(const char *buf, size_t len, short *events) {
+            if (len == 0) {
+                return 0; // SSL_write() doesn't accept empty buffer
+            }
+            int ret = SSL_write(ssl_, buf, len);
+            if (ret > 0) {
+                return ret;
+            }
+            if (this->want(ret, events)) {
+                errno = EAGAIN;
+            } else if (errno == EAGAIN) {
+                errno = EPIPE;
+            }
+            return -1;
+        }
+        /// TLS has no gathering write. sends the first non-empty buffer.
+        virtual ssize_t try_sendv(const struct iovec *iov, int iovcnt, short *events) {
+            for (int i=0; i<iovcnt; i++) {
+                if (iov[i].iov_len > 0) {
+                    return this->try_send((const char*)iov[i].iov_base, iov[i].iov_len, events);
+                }
+            }
+            return 0;
+        }
+        virtual ssize_t try_recv(char *buf, size_t len, short *events) {
+            int ret = SSL_read(ssl_, buf, len);
+            if (ret > 0) {
+                return ret;
+            }
+            int err = SSL_get_error(ssl_, ret);
+            if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && ret == 0)) {
+                return 0;
+            }
+            if (this->want(ret, events)) {
+                errno = EAGAIN;
+            } else if (errno == EAGAIN) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        }
+        virtual int close() {
+            if (ssl_) {
+                SSL_shutdown(ssl_); // don't wait for the peer's close_notify
+                SSL_free(ssl_);
+                ssl_ = NULL;
+            }
+            if (ctx_) {
+                SSL_CTX_free(ctx_);
+                ctx_ = NULL;
+            }
+            if (fd_ == -1) {
+                return 0;
+            }
+            return Connection::close();
+        }
+    protected:
+        /// the condition that the last SSL call wants. false on real error.
+        bool want(int ret, short *events) {
+            switch (SSL_get_error(ssl_, ret)) {
+            case SSL_ERROR_WANT_READ:
+                *events = POLLIN;
+                return true;
+            case SSL_ERROR_WANT_WRITE:
+                *events = POLLOUT;
+                return true;
+            default:
+                return false;
+            }
+        }
+    };
+#endif
+
+    /**
+     * resolve the reference(e.g. Location header) against the base URI.
+     * see also RFC 3986 section 5.2.
+     */
+    inline std::string resolve_uri(const nanouri::Uri &base, const std::string &ref) {
+        std::string r = ref.substr(0, ref.find('#'));
+        size_t colon = r.find(':');
+        if (colon != std::string::npos && r.find_first_of("/?") > colon) {
+            return r; // has scheme
+        }
+        std::string scheme = base.scheme();
+        if (r.compare(0, 2, "//") == 0) {
+            return scheme + ":" + r;
+        }
+        std::ostringstream authority;
+        authority << scheme << "://" << base.host();
+        if (base.port() != 0) {
+            authority << ":" << base.port();
+        }
+        std::string base_path = base.path_query();
+        base_path = base_path.substr(0, base_path.find('?'));
+        if (base_path.empty()) {
+            base_path = "/";
+        }
+        std::string path, query;
+        if (r.empty()) {
+            return authority.str() + base.path_query();
+        } else if (r[0] == '?') {
+            return authority.str() + base_path + r;
+        }
+        size_t q = r.find('?');
+        if (q != std::string::npos) {
+            query = r.substr(q);
+            r = r.substr(0, q);
+        }
+        if (r[0] == '/') {
+            path = r;
+        } else {
+            path = base_path.substr(0, base_path.rfind('/') + 1) + r;
+        }
+
+        // remove dot segments
+        std::vector<std::string> segments;
+        size_t pos = 1;
+        while (pos <= path.size()) {
+            size_t next = path.find('/', pos);
+            if (next == std::string::npos) { next = path.size(); }
+            std::string seg = path.substr(pos, next - pos);
+            bool last = next == path.size();
+            if (seg == "..") {
+                if (!segments.empty()) { segments.pop_back(); }
+                if (last) { segments.push_back(""); }
+            } else if (seg == ".") {
+                if (last) { segments.push_back(""); }
+            } else {
+                segments.push_back(seg);
+            }
+            pos = next + 1;
+        }
+        std::string normalized;
+        for (size_t i=0; i<segments.size(); i++) {
+            normalized += "/" + segments[i];
+        }
+        if (normalized.empty()) {
+            normalized = "/";
+        }
+        return authority.str() + normalized + query;
+    }
+
+    /**
+     * collects buffers and sends them by one writev(2).
+     * the buffers must be alive until flush().
+     * other sockets than Connection get the buffers one by one.
+     */
+    class WriteBatch {
+    private:
+        nanosocket::Socket &sock_;
+        struct iovec iov_[NANOWWW_WRITE_BATCH];
+        int iovcnt_;
+    public:
+        WriteBatch(nanosocket::Socket &sock) : sock_(sock), iovcnt_(0) { }
+        inline nanosocket::Socket &socket() { return sock_; }
+        inline bool push(const char *buf, size_t len) {
+            if (len == 0) {
+                return true;
+            }
+            if (iovcnt_ == NANOWWW_WRITE_BATCH && !this->flush()) {
+                return false;
+            }
+            iov_[iovcnt_].iov_base = const_cast<char*>(buf);
+            iov_[iovcnt_].iov_len  = len;
+            ++iovcnt_;
+            return true;
+        }
+        inline bool push(const std::string &buf) {
+            return this->push(buf.data(), buf.size());
+        }
+        bool flush() {
+            int iovcnt = iovcnt_;
+            iovcnt_ = 0;
+            Connection *conn = dynamic_cast<Connection*>(&sock_);
+            if (conn) {
+                return conn->sendv_all(iov_, iovcnt);
+            }
+            for (int i=0; i<iovcnt; i++) {
+                const char *src = (const char*)iov_[i].iov_base;
+                size_t remains = iov_[i].iov_len;
+                while (remains > 0) {
+                    int sent = sock_.send(src, remains);
+                    if (sent <= 0) {
+                        return false;
+                    }
+                    src     += sent;
+                    remains -= sent;
+                }
+            }
+            return true;
+        }
+    };
+
+    /**
+     * request body which is not kept in Request(see Request::set_body()).
+     * subclass it to produce the body by read(), or use BufferBodySource,
+     * FdBodySource or CallbackBodySource.
+     * if length() is unknown, the body is sent by chunked encoding.
+     */
+    class BodySource {
+    public:
+        virtual ~BodySource() { }
+        /// bytes of the body, or -1 if unknown
+        virtual long long length() = 0;
+        /**
+         * read the next bytes of the body into buf.
+         * @return bytes read, 0 at the end of the body, or -1 on error
+         */
+        virtual ssize_t read(char *buf, size_t len) = 0;
+        /// go back to the beginning, to send it again(retry, 307/308). false if it can't.
+        virtual bool rewind() { return false; }
+        /**
+         * add the body to the batch. by default, the bytes of read() are
+         * sent through buf, framed by chunked encoding if chunked is set.
+         */
+        virtual bool push(WriteBatch &batch, char *buf, size_t buflen, bool chunked) {
+            long long remains = this->length();
+            while (chunked || remains > 0) {
+                size_t want = chunked || (unsigned long long)remains > buflen ? buflen : (size_t)remains;
+                ssize_t n = this->read(buf, want);
+                if (n < 0 || (size_t)n > want) {
+                    return false;
+                }
+                if (n == 0) {
+                    if (!chunked) {
+                        return false; // shorter than length()
+                    }
+                    break;
+                }
+                char size_line[24];
+                if (chunked) {
+                    int len = snprintf(size_line, sizeof(size_line), "%lx\r\n", (unsigned long)n);
+                    if (!batch.push(size_line, len)) {
+                        return false;
+                    }
+                } else {
+                    remains -= n;
+                }
+                if (!batch.push(buf, n) || (chunked && !batch.push("\r\n", 2)) || !batch.flush()) {
+                    return false;
+                }
+            }
+            return !chunked || batch.push("0\r\n\r\n", 5);
+        }
+    };
+
+    /// body in memory, which may contain NULs. the buffer must outlive the request.
+    class BufferBodySource : public BodySource {
+    private:
+        const char *data_;
+        size_t len_;
+        size_t pos_;
+    public:
+        BufferBodySource(const char *data, size_t len) : data_(data), len_(len), pos_(0) { }
+        long long length() { return len_; }
+        ssize_t read(char *buf, size_t len) {
+            size_t n = std::min(len, len_ - pos_);
+            memcpy(buf, data_ + pos_, n);
+            pos_ += n;
+            return n;
+        }
+        bool rewind() {
+            pos_ = 0;
+            return true;
+        }
+        bool push(WriteBatch &batch, char *, size_t, bool) {
+            pos_ = len_;
+            return batch.push(data_, len_); // without copying
+        }
+    };
+
+    /**
+     * body read from the fd, from its current position. the fd is not closed.
+     * the length of a regular file is taken by fstat(2). a pipe or socket is
+     * sent by chunked encoding, unless the length is given.
+     * regular files are sent by sendfile(2) on plain HTTP, and can be sent again.
+     */
+    class FdBodySource : public BodySource {
+    private:
+        int fd_;
+        off_t start_;       // -1 if not seekable
+        long long length_;
+        long long pos_;     // bytes read
+    public:
+        FdBodySource(int fd, long long length=-1) : fd_(fd), length_(length), pos_(0) {
+            start_ = lseek(fd, 0, SEEK_CUR);
+            struct stat st;
+            if (length_ < 0 && start_ >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+                length_ = st.st_size > start_ ? st.st_size - start_ : 0;
+            }
+        }
+        long long length() { return length_; }
+        ssize_t read(char *buf, size_t len) {
+            if (length_ >= 0 && (unsigned long long)(length_ - pos_) < len) {
+                len = length_ - pos_;
+            }
+            ssize_t n;
+            do {
+                n = start_ >= 0 ? pread(fd_, buf, len, start_ + pos_) : ::read(fd_, buf, len);
+            } while (n < 0 && errno == EINTR);
+            if (n > 0) {
+                pos_ += n;
+            }
+            return n;
+        }
+        bool rewind() {
+            if (start_ < 0) {
+                return pos_ == 0;
+            }
+            pos_ = 0;
+            return true;
+        }
+        bool push(WriteBatch &batch, char *buf, size_t buflen, bool chunked) {
+            Connection *conn = dynamic_cast<Connection*>(&batch.socket());
+            if (chunked || start_ < 0 || !conn) {
+                return BodySource::push(batch, buf, buflen, chunked);
+            }
+            if (!batch.flush()) { // the header goes first
+                return false;
+            }
+            off_t offset = start_ + pos_;
+            ssize_t sent = conn->send_file(fd_, &offset, length_ - pos_);
+            if (sent < 0 && errno != EINVAL && errno != ENOSYS) {
+                return false;
+            }
+            if (sent >= 0) {
+                pos_ = offset - start_;
+            }
+            // the rest, by pread(2)
+            while (pos_ < length_) {
+                ssize_t n = this->read(buf, buflen);
+                if (n <= 0) {
+                    return false; // the file was truncated
+                }
+                if (!batch.push(buf, n) || !batch.flush()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    /**
+     * body produced by the function. it's called as BodySource::read(),
+     * with arg. the length is -1 if unknown.
+     */
+    class CallbackBodySource : public BodySource {
+    public:
+        typedef ssize_t (*read_func)(void *arg, char *buf, size_t len);
+    private:
+        read_func func_;
+        void *arg_;
+        long long length_;
+    public:
+        CallbackBodySource(read_func func, void *arg, long long length=-1)
+            : func_(func), arg_(arg), length_(length) { }
+        long long length() { return length_; }
+        ssize_t read(char *buf, size_t len) {
+            return func_(arg_, buf, len);
+        }
+    };
+
+    class Request {
+    private:
+        std::string content_;
+        BodySource *body_;           // instead of content_, if set
+        bool body_pushed_;           // body_ must be rewound to send it again
+        std::vector<char> body_buffer_;
+    protected:
+        Headers headers_;
+        std::string method_;
+        std::string protocol_;
+        nanouri::Uri uri_;
+        unsigned long long content_length_;
+    public:
+        Request(const char *method, const char *uri) {
+            this->Init(method, uri);
+            this->set_content("");
+        }
+        Request(const char *method, const char *uri, const char *content) {
+            this->Init(method, uri);
+            this->set_content(content);
+        }
+        /// content may contain NULs
+        Request(const char *method, const char *uri, const std::string &content) {
+            this->Init(method, uri);
+            this->set_content(content);
+        }
+        Request(const char *method, const char *uri, std::map<std::string, std::string> &post) {
+            std::string content;
+            std::map<std::string, std::string>::iterator iter = post.begin();
+            for (; iter!=post.end(); ++iter) {
+                if (!content.empty()) { content += "&"; }
+                std::string key = iter->first;
+                std::string val = iter->second;
+                content += nu_escape_uri(key) + "=" + nu_escape_uri(val);
+            }
+            this->set_header("Content-Type", "application/x-www-form-urlencoded");
+
+            this->Init(method, uri);
+            this->set_content(content.c_str());
+        }
+        virtual ~Request() { }
+        virtual bool write_content(nanosocket::Socket & sock) {
+            WriteBatch batch(sock);
+            return this->push_content(batch) && batch.flush();
+        }
+        virtual void finalize_header() { }
+        inline void set_header(const char* key, const char *val) {
+            this->headers_.set_header(key, val);
+        }
+        inline void set_header(const char* key, size_t val) {
+            this->headers_.set_header(key, (unsigned long long)val);
+        }
+        inline void push_header(const char* key, const char *val) {
+            this->headers_.push_header(key, val);
+        }
+        inline std::string get_header(const char* key) const {
+            return this->headers_.get_header(key);
+        }
+        inline StringRef find_header(const char* key) const {
+            return this->headers_.find_header(key);
+        }
+        bool write_header(nanosocket::Socket &sock, bool is_proxy) {
+            std::string hbuf;
+            this->serialize_header(&hbuf, is_proxy);
+            return this->send_all(sock, hbuf);
+        }
+        /**
+         * send the request line, headers and content in one writev(2).
+         * buf is the work area for the header. reuse it to avoid allocation.
+         */
+        bool write_request(nanosocket::Socket &sock, bool is_proxy, std::string *buf) {
+            WriteBatch batch(sock);
+            return this->push_request(batch, is_proxy, buf) && batch.flush();
+        }
+        /**
+         * add the whole request to the batch, to send many requests at once.
+         * buf holds the header, and must be kept until the batch is flushed.
+         */
+        bool push_request(WriteBatch &batch, bool is_proxy, std::string *buf) {
+            this->serialize_header(buf, is_proxy);
+            return batch.push(*buf) && this->push_content(batch);
+        }
+        /// write the request line and headers into *buf(cleared first).
+        void serialize_header(std::string *buf, bool is_proxy) {
+            // finalize content-length header
+            this->finalize_header();
+
+            bool chunked = body_ && body_->length() < 0;
+            if (chunked) {
+                headers_.remove_header("Content-Length");
+                this->set_header("Transfer-Encoding", "chunked");
+                if (protocol_ == "HTTP/1.0" && !headers_.has_header("Connection")) {
+                    this->set_header("Connection", "close"); // sent as HTTP/1.1 below
+                }
+            } else {
+                if (body_) {
+                    content_length_ = body_->length();
+                }
+                headers_.set_header("Content-Length", content_length_);
+            }
+
+            buf->clear();
+            buf->append(method_);
+            buf->append(" ", 1);
+            buf->append(is_proxy ? uri_.as_string() : uri_.path_query());
+            buf->append(" ", 1);
+            buf->append(chunked && protocol_ == "HTTP/1.0" ? "HTTP/1.1" : protocol_); // HTTP/1.0 has no chunked
+            buf->append("\r\n", 2);
+            headers_.append_to(buf);
+            buf->append("\r\n", 2);
+        }
+
+        /**
+         * send the body from the source, instead of the content.
+         * it's not owned, and must outlive the request.
+         * if source->length() is -1, the body is sent by
+         * "Transfer-Encoding: chunked"(and HTTP/1.1), otherwise with Content-Length.
+         */
+        inline void set_body(BodySource *source) {
+            content_.clear();
+            body_        = source;
+            body_pushed_ = false;
+        }
+        inline BodySource * body() { return body_; }
+        /**
+         * can it be sent again when the reused connection is closed before the
+         * response? the server may have processed it, so only idempotent
+         * methods are, and the body must be rewound.
+         */
+        bool can_resend() {
+            if (method_ != "GET" && method_ != "HEAD" && method_ != "OPTIONS"
+                    && method_ != "PUT" && method_ != "DELETE") {
+                return false;
+            }
+            if (body_ && body_pushed_) {
+                if (!body_->rewind()) {
+                    return false;
+                }
+                body_pushed_ = false;
+            }
+            return true;
+        }
+        inline void set_content(const char *content) {
+            this->set_content(content, strlen(content));
+        }
+        /// binary safe
+        inline void set_content(const char *content, size_t len) {
+            content_.assign(content, len);
+            content_length_ = content_.size();
+            body_ = NULL;
+        }
+        inline void set_content(const std::string &content) {
+            this->set_content(content.data(), content.size());
+        }
+
+        inline Headers *headers() { return &headers_; }
+        inline nanouri::Uri *uri() { return &uri_; }
+        inline void set_uri(const char *uri) { uri_.parse(uri); }
+        inline void set_uri(const std::string &uri) { this->set_uri(uri.c_str()); }
+        inline const std::string & method() const { return method_; }
+        /// "HTTP/1.0" or "HTTP/1.1"
+        inline const std::string & protocol() const { return protocol_; }
+        inline void set_protocol(const char *protocol) { protocol_ = protocol; }
+
+        void set_user_agent(const char* ua) {
+            this->headers_.set_user_agent(ua);
+        }
+        void set_user_agent(const std::string& ua) {
+            this->headers_.set_user_agent(ua);
+        }
+
+    protected:
+        /// add the body to the batch. file parts may be sent directly.
+        virtual bool push_content(WriteBatch &batch) {
+            if (!body_) {
+                return batch.push(content_);
+            }
+            if (body_pushed_ && !body_->rewind()) {
+                return false; // it can't be sent again
+            }
+            body_pushed_ = true;
+            if (body_buffer_.empty()) {
+                body_buffer_.resize(NANOWWW_BODY_BUFFER_SIZE);
+            }
+            return body_->push(batch, &body_buffer_[0], body_buffer_.size(), body_->length() < 0);
+        }
+        inline void Init(const char *method, const char *uri) {
+            body_        = NULL;
+            body_pushed_ = false;
+            method_  = method;
+            protocol_ = "HTTP/1.0";
+            assert(uri_.parse(uri));
+            this->set_user_agent(NANOWWW_USER_AGENT);
+            this->set_header("Host", uri_.host().c_str());
+        }
+        inline bool send_all(nanosocket::Socket &sock, const char *src, ssize_t srclen) {
+            ssize_t remains = srclen;
+            while (remains > 0) {
+                ssize_t sent = sock.send(src, remains);
+                if (sent <= 0) {
+                    return false;
+                } else {
+                    src     += sent;
+                    remains -= sent;
+                }
+            }
+            return true;
+        }
+        inline bool send_all(nanosocket::Socket &sock, const std::string & src) {
+            return this->send_all(sock, src.c_str(), src.size());
+        }
+    };
+
+    /**
+     * multipart/form-data request class.
+     * see also RFC 1867.
+     */
+    class RequestFormData : public Request {
+    private:
+        enum PartType {
+            PART_STRING,
+            PART_FILE
+        };
+        class PartElement {
+        public:
+            PartElement(PartType type, const std::string &name, const std::string &value) {
+                type_  = type;
+                name_  = name;
+                value_ = value;
+                fd_    = -1;
+
+                if (type == PART_STRING) {
+                    size_ = value_.size();
+                } else {
+                    // keep the file open until it's sent. size is taken from the same fd.
+                    size_ = 0;
+                    fd_ = open(value_.c_str(), O_RDONLY);
+                    if (fd_ == -1) { return; }
+                    fcntl(fd_, F_SETFD, FD_CLOEXEC);
+                    struct stat st;
+                    if (fstat(fd_, &st) != 0) {
+                        ::close(fd_);
+                        fd_ = -1;
+                        return;
+                    }
+                    size_ = st.st_size;
+                }
+            }
+            ~PartElement() {
+                if (fd_ != -1) {
+                    ::close(fd_);
+                }
+            }
+            inline std::string name() { return name_; }
+            inline std::string value() { return value_; }
+            inline std::string header() { return header_; }
+            inline void push_header(std::string &header) { header_ = header; }
+            inline PartType type() { return type_; }
+            inline size_t size() { return size_; }
+            /// file part is ready to be sent
+            inline bool is_valid() { return type_ == PART_STRING || fd_ != -1; }
+            /**
+             * add this part to the batch. file body is sent here,
+             * after flushing the preceding buffers.
+             */
+            bool push(WriteBatch &batch, char *buf, size_t buflen) {
+                if (!batch.push(header_)) {
+                    return false;
+                }
+                if (type_ == PART_STRING) {
+                    if (!batch.push(value_)) {
+                        return false;
+                    }
+                } else {
+                    if (!batch.flush()) {
+                        return false;
+                    }
+                    if (!this->send_file(batch.socket(), buf, buflen)) {
+                        return false;
+                    }
+                }
+                return batch.push("\r\n", sizeof("\r\n")-1);
+            }
+        private:
+            PartType type_;
+            std::string name_;
+            std::string value_;
+            std::string header_;
+            size_t size_;
+            int fd_;
+            PartElement(const PartElement &);
+            PartElement & operator=(const PartElement &);
+            /**
+             * plain TCP connection sends the file by sendfile(2), without copying
+             * it through userspace. otherwise(TLS, or sendfile is not supported
+             * for the file) read it by pread(2) into buf.
+             * explicit offsets are used, so the part can be sent again on retry.
+             */
+            bool send_file(nanosocket::Socket &sock, char *buf, size_t buflen) {
+                if (fd_ == -1) {
+                    return false;
+                }
+                off_t offset = 0;
+                Connection *conn = dynamic_cast<Connection*>(&sock);
+                if (conn) {
+                    ssize_t sent = conn->send_file(fd_, &offset, size_);
+                    if (sent < 0 && errno != EINVAL && errno != ENOSYS) {
+                        return false;
+                    }
+                    if (sent >= 0 && (size_t)offset == size_) {
+                        return true;
+                    }
+                    // fallback for the rest
+                }
+                while ((size_t)offset < size_) {
+                    ssize_t r = pread(fd_, buf, std::min(buflen, size_ - (size_t)offset), offset);
+                    if (r < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (r <= 0) {
+                        return false; // the file was truncated after fstat
+                    }
+                    if (!this->send_all(sock, buf, r)) {
+                        return false;
+                    }
+                    offset += r;
+                }
+                return true;
+            }
+            inline bool send_all(nanosocket::Socket &sock, const char *src, ssize_t srclen) {
+                ssize_t remains = srclen;
+                while (remains > 0) {
+                    ssize_t sent = sock.send(src, remains);
+                    if (sent <= 0) {
+                        return false;
+                    } else {
+                        src     += sent;
+                        remains -= sent;
+                    }
+                }
+                return true;
+            }
+        };
+        std::vector<PartElement*> elements_;
+        std::string boundary_;
+        std::string terminator_;
+        size_t multipart_buffer_size_;
+        char *multipart_buffer_;
+    public:
+        RequestFormData(const char *method, const char *uri):Request(method, uri) {
+            this->Init(method, uri);
+            boundary_ = RequestFormData::generate_boundary(10); // enough randomness
+
+            std::string content_type("multipart/form-data; boundary=\"");
+            content_type += boundary_;
+            content_type += "\"";
+            this->set_header("Content-Type", content_type.c_str());
+
+            content_length_ = 0;
+
+            multipart_buffer_size_ = NANOWWW_DEFAULT_MULTIPART_BUFFER_SIZE;
+            multipart_buffer_ = new char [multipart_buffer_size_];
+            assert(multipart_buffer_);
+        }
+        ~RequestFormData() {
+            delete [] multipart_buffer_;
+            for (size_t i=0; i<elements_.size(); i++) {
+                delete elements_[i];
+            }
+        }
+        void set_multipart_buffer_size(size_t s) {
+            multipart_buffer_size_ = s;
+            delete [] multipart_buffer_;
+            multipart_buffer_ = new char [s];
+            assert(multipart_buffer_);
+        }
+        void finalize_header() {
+            content_length_ = 0;
+            std::vector<PartElement*>::iterator iter = elements_.begin();
+            for (;iter != elements_.end(); ++iter) {
+                PartElement *elem = *iter;
+                std::string buf;
+                buf += std::string("--")+boundary_+"\r\n";
+                buf += std::string("Content-Disposition: form-data; name=\"")+elem->name()+"\"";
+                if (elem->type() == PART_FILE) {
+                    buf += std::string("; filename=\"");
+                    buf += elem->value()  + "\"";
+                }
+                buf += "\r\n\r\n";
+                elem->push_header(buf);
+                content_length_ += buf.size();
+                content_length_ += elem->size();
+                content_length_ += 2;
+            }
+            terminator_ = std::string("--")+boundary_+"--\r\n";
+            content_length_ += terminator_.size();
+        }
+        static inline std::string generate_boundary(int n) {
+            srand(time(NULL));
+
+            std::string sbuf;
+            for (int i=0; i<n*3; i++) {
+                sbuf += (float(rand())/RAND_MAX*256);
+            }
+            int bbufsiz = nb_base64_needed_encoded_length(sbuf.size());
+            unsigned char * bbuf = new unsigned char[bbufsiz];
+            assert(bbuf);
+            nb_base64_encode((const unsigned char*)sbuf.c_str(), sbuf.size(), (unsigned char*)bbuf);
+            std::string ret((char*)bbuf);
+            delete [] bbuf;
+            return ret;
+        }
+        inline std::string boundary() { return boundary_; }
+    protected:
+        /// part headers, string parts and the terminator go out in batches.
+        bool push_content(WriteBatch &batch) {
+            std::vector<PartElement*>::iterator iter = elements_.begin();
+            for (;iter != elements_.end(); ++iter) {
+                if (!(*iter)->push(batch, multipart_buffer_, multipart_buffer_size_)) {
+                    return false;
+                }
+            }
+            return batch.push(terminator_);
+        }
+    public:
+        inline bool add_string(const std::string &name, const std::string &body) {
+            elements_.push_back(new PartElement(PART_STRING, name, body));
+            return true;
+        }
+        /**
+         * the file is opened here, and kept open until the request is destroyed.
+         * @return false if the file cannot be opened
+         */
+        inline bool add_file(const std::string &name, const std::string &fname) {
+            PartElement *elem = new PartElement(PART_FILE, name, fname);
+            if (!elem->is_valid()) {
+                delete elem;
+                return false;
+            }
+            elements_.push_back(elem);
+            return true;
+        }
+    };
+
+    /**
+     * socket which only records the sent bytes.
+     * used to serialize a Request into memory.
+     */
+    class BufferSocket : public nanosocket::Socket {
+    private:
+        std::string *buf_;
+    public:
+        BufferSocket(std::string *buf) : buf_(buf) { }
+        virtual bool connect(const char *host, short port) {
+            (void)host; (void)port;
+            return false;
+        }
+        virtual int send(const char *buf, size_t len) {
+            buf_->append(buf, len);
+            return len;
+        }
+        virtual int recv(char *buf, size_t len) {
+            (void)buf; (void)len;
+            return -1;
+        }
+        virtual int close() { return 0; }
+    };
+
+    /**
+     * pool of idle keep-alive connections.
+     * connections are keyed by scheme/host/port/proxy.
+     */
+    class ConnectionPool {
+    private:
+        struct Entry {
+            std::string key;
+            Connection *sock;
+            double released_at;
+        };
+        typedef std::list<Entry>::iterator iterator;
+        std::list<Entry> idle_; // most recently released connection comes first
+        size_t max_idle_;
+        unsigned int idle_timeout_;
+    public:
+        ConnectionPool() {
+            max_idle_     = NANOWWW_DEFAULT_MAX_IDLE_CONNECTIONS;
+            idle_timeout_ = NANOWWW_DEFAULT_IDLE_TIMEOUT;
+        }
+        ~ConnectionPool() {
+            this->clear();
+        }
+        /// max number of idle connections kept in the pool
+        inline void set_max_idle(size_t n) {
+            max_idle_ = n;
+            this->expire();
+        }
+        inline size_t max_idle() { return max_idle_; }
+        /// idle connections older than this(in sec) are closed
+        inline void set_idle_timeout(unsigned int sec) { idle_timeout_ = sec; }
+        inline unsigned int idle_timeout() { return idle_timeout_; }
+        inline size_t size() { return idle_.size(); }
+
+        /**
+         * @return idle connection for the key, or NULL.
+         * the caller owns the returned socket.
+         */
+        Connection * checkout(const std::string &key) {
+            this->expire();
+            for (iterator iter = idle_.begin(); iter != idle_.end(); ++iter) {
+                if (iter->key != key) {
+                    continue;
+                }
+                Connection *sock = iter->sock;
+                idle_.erase(iter);
+                if (ConnectionPool::is_stale(sock)) {
+                    delete sock;
+                    return this->checkout(key);
+                }
+                return sock;
+            }
+            return NULL;
+        }
+        /// give the connection back to the pool. pool owns it after this call.
+        void checkin(const std::string &key, Connection *sock) {
+            sock->set_timing(NULL); // the response may go away
+            Entry e;
+            e.key         = key;
+            e.sock        = sock;
+            e.released_at = monotonic_time();
+            idle_.push_front(e);
+            this->expire();
+        }
+        /// close all idle connections
+        void clear() {
+            for (iterator iter = idle_.begin(); iter != idle_.end(); ++iter) {
+                delete iter->sock;
+            }
+            idle_.clear();
+        }
+    protected:
+        void expire() {
+            double now = monotonic_time();
+            while (!idle_.empty() && (
+                   idle_.size() > max_idle_
+                || now - idle_.back().released_at >= idle_timeout_
+            )) {
+                delete idle_.back().sock;
+                idle_.pop_back();
+            }
+        }
+        /**
+         * idle connection must not be readable.
+         * readable means the server closed it, or sent garbage.
+         */
+        static bool is_stale(Connection *sock) {
+            struct pollfd pfd;
+            pfd.fd      = sock->fd();
+            pfd.events  = POLLIN;
+            pfd.revents = 0;
+            int ret = poll(&pfd, 1, 0);
+            return ret != 0;
+        }
+    };
+
+    /**
+     * idle connections shared by the Clients in many threads
+     * (see Client::set_shared_pool()). it's split into shards with their own
+     * locks. a thread checks in to its own shard, and checks out from it
+     * first, then from the others which are not locked, so the threads
+     * rarely wait for each other.
+     */
+    class SharedConnectionPool {
+    private:
+        struct Shard {
+            Mutex mutex;
+            ConnectionPool pool;
+            char pad[64]; // keep the locks on different cache lines
+        };
+        std::vector<Shard*> shards_;
+        SharedConnectionPool(const SharedConnectionPool &);
+        SharedConnectionPool & operator=(const SharedConnectionPool &);
+    public:
+        /// max_idle is for each shard
+        SharedConnectionPool(size_t shards=NANOWWW_POOL_SHARDS, size_t max_idle=NANOWWW_DEFAULT_MAX_IDLE_CONNECTIONS) {
+            shards_.resize(shards > 0 ? shards : 1);
+            for (size_t i=0; i<shards_.size(); i++) {
+                shards_[i] = new Shard();
+                shards_[i]->pool.set_max_idle(max_idle);
+            }
+        }
+        ~SharedConnectionPool() {
+            for (size_t i=0; i<shards_.size(); i++) {
+                delete shards_[i];
+            }
+        }
+        inline size_t shards() { return shards_.size(); }
+        /// idle connections older than this(in sec) are closed
+        void set_idle_timeout(unsigned int sec) {
+            for (size_t i=0; i<shards_.size(); i++) {
+                ScopedLock lock(shards_[i]->mutex);
+                shards_[i]->pool.set_idle_timeout(sec);
+            }
+        }
+        /// number of idle connections
+        size_t size() {
+            size_t n = 0;
+            for (size_t i=0; i<shards_.size(); i++) {
+                ScopedLock lock(shards_[i]->mutex);
+                n += shards_[i]->pool.size();
+            }
+            return n;
+        }
+        /// same as ConnectionPool::checkout()
+        Connection * checkout(const std::string &key) {
+            size_t home = this->home_shard();
+            for (size_t i=0; i<shards_.size(); i++) {
+                Shard *shard = shards_[(home + i) % shards_.size()];
+                if (i == 0) {
+                    shard->mutex.lock();
+                } else if (!shard->mutex.try_lock()) {
+                    continue; // busy. don't wait for it
+                }
+                Connection *sock = shard->pool.checkout(key);
+                shard->mutex.unlock();
+                if (sock) {
+                    return sock;
+                }
+            }
+            return NULL;
+        }
+        /// same as ConnectionPool::checkin()
+        void checkin(const std::string &key, Connection *sock) {
+            Shard *shard = shards_[this->home_shard()];
+            ScopedLock lock(shard->mutex);
+            shard->pool.checkin(key, sock);
+        }
+        /// close all idle connections
+        void clear() {
+            for (size_t i=0; i<shards_.size(); i++) {
+                ScopedLock lock(shards_[i]->mutex);
+                shards_[i]->pool.clear();
+            }
+        }
+    protected:
+        /// shard of the calling thread
+        size_t home_shard() {
+            unsigned long h = (unsigned long)pthread_self();
+            h ^= h >> 17;
+            h *= 0x9E3779B1UL;
+            return (h >> 11) % shards_.size();
+        }
+    };
+
+    /**
+     * HTTP cache for Client(RFC 9111), in memory and bounded by bytes.
+     * fresh responses are returned without a request, and stale ones are
+     * revalidated by If-None-Match/If-Modified-Since. the bodies are shared
+     * with the Responses, not copied(see SharedContent).
+     * entries evicted from memory can be kept in a directory(set_disk_tier()),
+     * and are loaded back by mmap(2) when they are requested again.
+     * it can be shared by Clients in many threads.
+     *
+     *   nanowww::ResponseCache cache(16 * 1024 * 1024);
+     *   nanowww::Client www;
+     *   www.set_cache(&cache);
+     */
+    class ResponseCache {
+    public:
+        enum State {
+            MISS,
+            FRESH, // can be used as is
+            STALE  // must be revalidated
+        };
+        struct Stats {
+            unsigned long hits;          // fresh responses returned without a request
+            unsigned long misses;        // including stale ones which got a new response
+            unsigned long revalidations; // stale ones validated by 304
+            unsigned long disk_hits;     // loaded from the disk tier
+            unsigned long stores;
+            unsigned long evictions;     // from memory
+        };
+    protected:
+        struct Entry {
+            std::string key;
+            int status;
+            std::string message;
+            Headers headers;
+            SharedContent content;
+            time_t response_time;          // when it was received, in wall clock
+            std::vector<std::string> vary; // header name and the value in the request, in turn
+            size_t bytes;
+        };
+        typedef std::list<Entry>::iterator iterator;
+        Mutex mutex_;
+        std::list<Entry> lru_; // most recently used first
+        std::map<std::string, iterator> index_;
+        size_t max_bytes_;
+        size_t bytes_;
+        Stats stats_;
+        Mutex disk_mutex_;
+        std::string disk_dir_;
+        unsigned long long disk_max_bytes_;
+        unsigned long long disk_bytes_;
+        unsigned long disk_seq_; // for temporary file names
+    public:
+        ResponseCache(size_t max_bytes=NANOWWW_CACHE_MAX_BYTES) {
+            max_bytes_      = max_bytes;
+            bytes_          = 0;
+            disk_max_bytes_ = 0;
+            disk_bytes_     = 0;
+            disk_seq_       = 0;
+            memset(&stats_, 0, sizeof(stats_));
+        }
+        virtual ~ResponseCache() { }
+        /// entries are evicted in LRU order to keep the bytes(bodies and headers) under this
+        void set_max_bytes(size_t max_bytes) {
+            std::list<Entry> evicted;
+            {
+                ScopedLock lock(mutex_);
+                max_bytes_ = max_bytes;
+                this->evict(&evicted);
+            }
+            this->spill(evicted);
+        }
+        inline size_t max_bytes() { return max_bytes_; }
+        inline size_t bytes() {
+            ScopedLock lock(mutex_);
+            return bytes_;
+        }
+        /// number of entries in memory
+        inline size_t size() {
+            ScopedLock lock(mutex_);
+            return lru_.size();
+        }
+        inline Stats stats() {
+            ScopedLock lock(mutex_);
+            return stats_;
+        }
+        /// drop the entries in memory. the disk tier is kept.
+        void clear() {
+            ScopedLock lock(mutex_);
+            lru_.clear();
+            index_.clear();
+            bytes_ = 0;
+        }
+        /**
+         * keep the entries evicted from memory(or too large for it) in files
+         * of dir, up to max_bytes. the files are reused by other processes.
+         * call it before sharing the cache.
+         * @return false if dir is not a directory
+         */
+        bool set_disk_tier(const std::string &dir, unsigned long long max_bytes) {
+            struct stat st;
+            if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+                return false;
+            }
+            ScopedLock lock(disk_mutex_);
+            disk_dir_       = dir;
+            disk_max_bytes_ = max_bytes;
+            this->trim_disk();
+            return true;
+        }
+
+        /**
+         * GET without conditional or Range headers can be cached.
+         */
+        static bool is_cacheable_request(Request &req) {
+            static const char *conditionals[] = {
+                "If-None-Match", "If-Modified-Since", "If-Match", "If-Unmodified-Since", "If-Range", "Range"
+            };
+            if (req.method() != "GET") {
+                return false;
+            }
+            for (size_t i=0; i<sizeof(conditionals)/sizeof(conditionals[0]); i++) {
+                if (req.headers()->has_header(conditionals[i])) {
+                    return false;
+                }
+            }
+            return !ResponseCache::has_directive(req.headers()->get_header("Cache-Control"), "no-store");
+        }
+        /**
+         * find the response for the request, and copy it to *res(the body is shared).
+         * @return FRESH, STALE(res has validators), or MISS(res is not changed)
+         */
+        State lookup(Request &req, Response *res) {
+            std::string key = req.uri()->as_string();
+            {
+                ScopedLock lock(mutex_);
+                std::map<std::string, iterator>::iterator found = index_.find(key);
+                if (found != index_.end()) {
+                    lru_.splice(lru_.begin(), lru_, found->second);
+                    return this->fill(req, *found->second, res);
+                }
+                if (disk_dir_.empty()) {
+                    ++stats_.misses;
+                    return MISS;
+                }
+            }
+            std::list<Entry> loaded(1);
+            if (!this->load(key, &loaded.front())) {
+                ScopedLock lock(mutex_);
+                ++stats_.misses;
+                return MISS;
+            }
+            std::list<Entry> evicted;
+            State state;
+            {
+                ScopedLock lock(mutex_);
+                ++stats_.disk_hits;
+                if (loaded.front().bytes > max_bytes_) { // used once, without promotion
+                    state = this->fill(req, loaded.front(), res);
+                } else {
+                    this->insert(&loaded, &evicted);
+                    state = this->fill(req, lru_.front(), res);
+                }
+            }
+            this->spill(evicted);
+            return state;
+        }
+        /**
+         * give the response of the request from the server.
+         * if it's 304 for stale(from lookup()), *res becomes the cached response
+         * with the updated headers. cacheable responses are stored.
+         */
+        void update(Request &req, Response *res, Response *stale) {
+            time_t now = time(NULL);
+            if (stale && res->status() == 304) {
+                // the fields of 304 replace the stored ones of the names. repeated ones are all kept.
+                Headers *headers = stale->headers();
+                std::vector<size_t> fields;
+                for (size_t i=0; i<res->headers()->size(); i++) {
+                    std::string name = res->headers()->name(i).str();
+                    if (strcasecmp(name.c_str(), "Content-Length") != 0
+                            && strcasecmp(name.c_str(), "Transfer-Encoding") != 0) {
+                        headers->remove_header(name.c_str());
+                        fields.push_back(i);
+                    }
+                }
+                for (size_t i=0; i<fields.size(); i++) {
+                    headers->push_header(res->headers()->name(fields[i]).str().c_str(), res->headers()->value(fields[i]).str());
+                }
+                std::vector<Response::Hop> hops(res->hops());
+                *res = *stale;
+                res->set_hops(hops);
+                {
+                    ScopedLock lock(mutex_);
+                    ++stats_.revalidations;
+                }
+                this->store(req, res, now);
+                return;
+            }
+            if (stale) {
+                ScopedLock lock(mutex_);
+                ++stats_.misses;
+            }
+            if (ResponseCache::is_cacheable_response(res)) {
+                this->store(req, res, now);
+            } else {
+                this->invalidate(req.uri()->as_string());
+            }
+        }
+        /// forget the URI, e.g. after POST/PUT/DELETE to it. the disk tier is included.
+        void invalidate(const std::string &uri) {
+            {
+                ScopedLock lock(mutex_);
+                std::map<std::string, iterator>::iterator found = index_.find(uri);
+                if (found != index_.end()) {
+                    bytes_ -= found->second->bytes;
+                    lru_.erase(found->second);
+                    index_.erase(found);
+                }
+            }
+            ScopedLock lock(disk_mutex_);
+            if (!disk_dir_.empty()) {
+                unlink(this->disk_path(uri).c_str());
+            }
+        }
+
+        /// directive of Cache-Control. *arg is its number, or -1 if it has no argument.
+        static bool has_directive(const std::string &cc, const char *name, long *arg=NULL) {
+            size_t name_len = strlen(name);
+            size_t pos = 0;
+            while (pos < cc.size()) {
+                size_t end = cc.find(',', pos);
+                if (end == std::string::npos) {
+                    end = cc.size();
+                }
+                while (pos < end && (cc[pos] == ' ' || cc[pos] == '\t')) {
+                    ++pos;
+                }
+                size_t eq = cc.find('=', pos);
+                size_t token_end = eq < end ? eq : end;
+                while (token_end > pos && (cc[token_end-1] == ' ' || cc[token_end-1] == '\t')) {
+                    --token_end;
+                }
+                if (token_end - pos == name_len && strncasecmp(cc.data() + pos, name, name_len) == 0) {
+                    if (arg) {
+                        *arg = -1;
+                        if (eq < end) {
+                            const char *value = cc.c_str() + eq + 1;
+                            *arg = strtol(*value == '"' ? value + 1 : value, NULL, 10);
+                        }
+                    }
+                    return true;
+                }
+                pos = end + 1;
+            }
+            return false;
+        }
+        /// parse IMF-fixdate("Sun, 06 Nov 1994 08:49:37 GMT"). -1 on error.
+        static time_t parse_date(const StringRef &value) {
+            if (value.is_null()) {
+                return -1;
+            }
+            struct tm tm;
+            memset(&tm, 0, sizeof(tm));
+            std::string str = value.str();
+            if (!strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm)) {
+                return -1;
+            }
+            return timegm(&tm);
+        }
+        /// sec the response is fresh for
+        static long freshness_lifetime(const Headers &headers, time_t response_time) {
+            long max_age;
+            if (ResponseCache::has_directive(headers.get_header("Cache-Control"), "max-age", &max_age)) {
+                return max_age;
+            }
+            time_t date = ResponseCache::parse_date(headers.find_header("Date"));
+            if (date < 0) {
+                date = response_time;
+            }
+            StringRef expires = headers.find_header("Expires");
+            if (!expires.is_null()) {
+                time_t t = ResponseCache::parse_date(expires);
+                return t < 0 ? 0 : t - date; // invalid Expires means expired
+            }
+            // heuristic: 10% of the time since the last modification
+            time_t last_modified = ResponseCache::parse_date(headers.find_header("Last-Modified"));
+            if (last_modified >= 0 && last_modified < date) {
+                return std::min((long)(date - last_modified) / 10, (long)NANOWWW_CACHE_HEURISTIC_LIFETIME);
+            }
+            return 0;
+        }
+        /// sec since the response was generated by the server
+        static long current_age(const Headers &headers, time_t response_time, time_t now) {
+            time_t date = ResponseCache::parse_date(headers.find_header("Date"));
+            long apparent_age = date >= 0 && response_time > date ? response_time - date : 0;
+            size_t age_value = 0;
+            headers.find_header("Age").to_size(&age_value);
+            return std::max(apparent_age, (long)age_value) + (now - response_time);
+        }
+    protected:
+        /// copy the entry to *res if it can be used for req. call with the lock.
+        State fill(Request &req, const Entry &e, Response *res) {
+            for (size_t i=0; i+1<e.vary.size(); i+=2) {
+                if (req.headers()->get_header(e.vary[i].c_str()) != e.vary[i+1]) {
+                    ++stats_.misses;
+                    return MISS;
+                }
+            }
+            time_t now = time(NULL);
+            long age = ResponseCache::current_age(e.headers, e.response_time, now);
+            std::string req_cc = req.headers()->get_header("Cache-Control");
+            long max_age = -1;
+            bool fresh = !ResponseCache::has_directive(e.headers.get_header("Cache-Control"), "no-cache")
+                && !ResponseCache::has_directive(req_cc, "no-cache")
+                && req.headers()->get_header("Pragma") != "no-cache"
+                && !(ResponseCache::has_directive(req_cc, "max-age", &max_age) && max_age >= 0 && age > max_age)
+                && ResponseCache::freshness_lifetime(e.headers, e.response_time) > age;
+            if (!fresh && !e.headers.has_header("ETag") && !e.headers.has_header("Last-Modified")) {
+                ++stats_.misses; // can't be revalidated
+                return MISS;
+            }
+            res->reset();
+            res->set_status(e.status);
+            res->set_message(e.message.c_str(), e.message.size());
+            *res->headers() = e.headers;
+            res->set_shared_content(e.content);
+            if (fresh) {
+                ++stats_.hits;
+                return FRESH;
+            }
+            return STALE;
+        }
+        static bool is_cacheable_response(Response *res) {
+            static const int statuses[] = { 200, 203, 204, 300, 301, 404, 405, 410, 414, 501 };
+            bool cacheable_status = false;
+            for (size_t i=0; i<sizeof(statuses)/sizeof(statuses[0]); i++) {
+                cacheable_status = cacheable_status || res->status() == statuses[i];
+            }
+            Headers *headers = res->headers();
+            return cacheable_status
+                && !ResponseCache::has_directive(headers->get_header("Cache-Control"), "no-store")
+                && headers->get_header("Vary") != "*"
+                && (ResponseCache::freshness_lifetime(*headers, time(NULL)) > 0
+                    || headers->has_header("ETag") || headers->has_header("Last-Modified"));
+        }
+        /// store the response. its body is moved into the cache and shared.
+        void store(Request &req, Response *res, time_t now) {
+            std::list<Entry> entry(1);
+            Entry &e = entry.front();
+            e.key           = req.uri()->as_string();
+            e.status        = res->status();
+            e.message       = res->message();
+            e.headers       = *res->headers();
+            e.content       = res->share_content();
+            e.response_time = now;
+            std::string vary = res->get_header("Vary");
+            for (size_t pos = 0; pos < vary.size(); ) {
+                size_t end = vary.find(',', pos);
+                if (end == std::string::npos) {
+                    end = vary.size();
+                }
+                std::string name = vary.substr(pos, end - pos);
+                name.erase(0, name.find_first_not_of(" \t"));
+                name.erase(name.find_last_not_of(" \t") + 1);
+                if (!name.empty()) {
+                    e.vary.push_back(name);
+                    e.vary.push_back(req.headers()->get_header(name.c_str()));
+                }
+                pos = end + 1;
+            }
+            e.bytes = sizeof(Entry) + e.key.size() + e.message.size() + e.headers.as_string().size()
+                    + e.content.str().size();
+            for (size_t i=0; i<e.vary.size(); i++) {
+                e.bytes += e.vary[i].size();
+            }
+
+            std::list<Entry> evicted;
+            {
+                ScopedLock lock(mutex_);
+                ++stats_.stores;
+                this->insert(&entry, &evicted);
+            }
+            this->spill(evicted);
+        }
+        /// move the entry into the front. call with the lock.
+        void insert(std::list<Entry> *entry, std::list<Entry> *evicted) {
+            const std::string &key = entry->front().key;
+            std::map<std::string, iterator>::iterator found = index_.find(key);
+            if (found != index_.end()) {
+                bytes_ -= found->second->bytes;
+                lru_.erase(found->second);
+            }
+            bytes_ += entry->front().bytes;
+            lru_.splice(lru_.begin(), *entry);
+            index_[key] = lru_.begin();
+            this->evict(evicted);
+        }
+        /// move LRU entries over max_bytes_ into *evicted. call with the lock.
+        void evict(std::list<Entry> *evicted) {
+            while (bytes_ > max_bytes_ && !lru_.empty()) {
+                iterator last = --lru_.end();
+                bytes_ -= last->bytes;
+                index_.erase(last->key);
+                evicted->splice(evicted->begin(), lru_, last);
+                ++stats_.evictions;
+            }
+        }
+
+        /// file of the key in the disk tier: FNV-1a hash of the key
+        std::string disk_path(const std::string &key) {
+            unsigned long long hash = 14695981039346656037ULL;
+            for (size_t i=0; i<key.size(); i++) {
+                hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+            }
+            char name[17];
+            snprintf(name, sizeof(name), "%016llx", hash);
+            return disk_dir_ + "/" + name;
+        }
+        /**
+         * write the evicted entries to the disk tier. the file is
+         *   "NANOWWW-CACHE 1\n" key "\n" "status time vary_count header_len body_len\n"
+         *   message "\n" (vary name "\n" value "\n")* headers body
+         */
+        void spill(const std::list<Entry> &evicted) {
+            ScopedLock lock(disk_mutex_);
+            if (disk_dir_.empty()) {
+                return;
+            }
+            for (std::list<Entry>::const_iterator iter = evicted.begin(); iter != evicted.end(); ++iter) {
+                const Entry &e = *iter;
+                std::string headers = e.headers.as_string();
+                std::ostringstream head;
+                head << "NANOWWW-CACHE 1\n" << e.key << "\n"
+                     << e.status << " " << (long long)e.response_time << " " << e.vary.size() / 2 << " "
+                     << headers.size() << " " << e.content.str().size() << "\n"
+                     << e.message << "\n";
+                for (size_t i=0; i<e.vary.size(); i++) {
+                    head << e.vary[i] << "\n";
+                }
+                head << headers;
+                std::string meta = head.str();
+
+                std::ostringstream tmp;
+                tmp << disk_dir_ << "/.tmp." << getpid() << "." << ++disk_seq_;
+                int fd = open(tmp.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (fd == -1) {
+                    continue;
+                }
+                struct iovec iov[2];
+                iov[0].iov_base = (void *)meta.data();
+                iov[0].iov_len  = meta.size();
+                iov[1].iov_base = (void *)e.content.str().data();
+                iov[1].iov_len  = e.content.str().size();
+                bool ok = ResponseCache::write_all(fd, iov, 2);
+                if (::close(fd) != 0 || !ok || rename(tmp.str().c_str(), this->disk_path(e.key).c_str()) != 0) {
+                    unlink(tmp.str().c_str());
+                    continue;
+                }
+                disk_bytes_ += meta.size() + e.content.str().size();
+            }
+            if (disk_bytes_ > disk_max_bytes_) {
+                this->trim_disk();
+            }
+        }
+        static bool write_all(int fd, struct iovec *iov, int iovcnt) {
+            while (iovcnt > 0) {
+                ssize_t n = writev(fd, iov, iovcnt);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+                    n -= iov->iov_len;
+                    ++iov; --iovcnt;
+                }
+                if (iovcnt > 0) {
+                    iov->iov_base = (char *)iov->iov_base + n;
+                    iov->iov_len -= n;
+                }
+            }
+            return true;
+        }
+        /// read the entry of the key from the disk tier, by mmap(2)
+        bool load(const std::string &key, Entry *e) {
+            std::string path;
+            {
+                ScopedLock lock(disk_mutex_);
+                if (disk_dir_.empty()) {
+                    return false;
+                }
+                path = this->disk_path(key);
+            }
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                return false;
+            }
+            struct stat st;
+            void *map = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            ::close(fd);
+            if (map == MAP_FAILED) {
+                return false;
+            }
+            bool ok = this->parse_file((const char *)map, st.st_size, key, e);
+            munmap(map, st.st_size);
+            if (ok) {
+                utimes(path.c_str(), NULL); // for LRU of trim_disk()
+            }
+            return ok;
+        }
+        bool parse_file(const char *p, size_t len, const std::string &key, Entry *e) {
+            const char *end = p + len;
+            std::string line;
+            if (!ResponseCache::read_line(&p, end, &line) || line != "NANOWWW-CACHE 1"
+                    || !ResponseCache::read_line(&p, end, &line) || line != key // hash collision
+                    || !ResponseCache::read_line(&p, end, &line)) {
+                return false;
+            }
+            long long response_time;
+            unsigned long vary_count, headers_len, body_len;
+            if (sscanf(line.c_str(), "%d %lld %lu %lu %lu", &e->status, &response_time,
+                       &vary_count, &headers_len, &body_len) != 5
+                    || !ResponseCache::read_line(&p, end, &e->message)) {
+                return false;
+            }
+            for (unsigned long i=0; i<vary_count * 2; i++) {
+                if (!ResponseCache::read_line(&p, end, &line)) {
+                    return false;
+                }
+                e->vary.push_back(line);
+            }
+            if ((size_t)(end - p) != headers_len + body_len) {
+                return false;
+            }
+            const char *headers_end = p + headers_len;
+            while (p < headers_end) {
+                const char *eol = (const char *)memchr(p, '\n', headers_end - p);
+                const char *colon = (const char *)memchr(p, ':', headers_end - p);
+                if (!eol || !colon || colon > eol || eol - colon < 3) {
+                    return false;
+                }
+                e->headers.push_header(p, colon - p, colon + 2, eol - 1 - (colon + 2)); // ": ", "\r\n"
+                p = eol + 1;
+            }
+            std::string body(p, body_len);
+            e->key           = key;
+            e->response_time = (time_t)response_time;
+            e->content.take(&body);
+            e->bytes = sizeof(Entry) + key.size() + e->message.size() + headers_len + body_len;
+            return true;
+        }
+        static bool read_line(const char **p, const char *end, std::string *line) {
+            const char *eol = (const char *)memchr(*p, '\n', end - *p);
+            if (!eol) {
+                return false;
+            }
+            line->assign(*p, eol - *p);
+            *p = eol + 1;
+            return true;
+        }
+        /// remove the least recently used files over disk_max_bytes_. call with disk_mutex_.
+        void trim_disk() {
+            DIR *dir = opendir(disk_dir_.c_str());
+            if (!dir) {
+                return;
+            }
+            std::vector<std::pair<time_t, std::pair<std::string, off_t> > > files;
+            unsigned long long total = 0;
+            struct dirent *ent;
+            while ((ent = readdir(dir)) != NULL) {
+                if (ent->d_name[0] == '.') {
+                    continue; // including temporary files
+                }
+                std::string path = disk_dir_ + "/" + ent->d_name;
+                struct stat st;
+                if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                    files.push_back(std::make_pair(st.st_mtime, std::make_pair(path, st.st_size)));
+                    total += st.st_size;
+                }
+            }
+            closedir(dir);
+            std::sort(files.begin(), files.end());
+            for (size_t i=0; i<files.size() && total > disk_max_bytes_; i++) {
+                if (unlink(files[i].second.first.c_str()) == 0) {
+                    total -= files[i].second.second;
+                }
+            }
+            disk_bytes_ = total;
+        }
+    };
+
+#ifdef NANOWWW_ENABLE_TIMING
+    /**
+     * process-wide counters and latency histograms of the exchanges made by Client.
+     * updated atomically from any thread. scrape them by snapshot(), or
+     * format() for the Prometheus text format.
+     *
+     *   std::cout << nanowww::Metrics::global().format();
+     */
+    class Metrics {
+    public:
+        enum {
+            HISTOGRAM_DURATION, // start to done
+            HISTOGRAM_DNS,      // connect_start to dns_done
+            HISTOGRAM_CONNECT,  // dns_done to connect_done
+            HISTOGRAM_TLS,      // connect_done to tls_done
+            HISTOGRAM_WAIT,     // request_sent to first_byte
+            NUM_HISTOGRAMS
+        };
+        enum { NUM_BUCKETS = 14 }; // the last one is +Inf
+        struct Histogram {
+            unsigned long long buckets[NUM_BUCKETS]; // not cumulative
+            unsigned long long count;
+            unsigned long long sum_usec;
+        };
+        struct Snapshot {
+            unsigned long long requests;
+            unsigned long long errors;
+            unsigned long long connections; // newly connected
+            unsigned long long reused;      // sent over pooled connections
+            unsigned long long bytes_sent;
+            unsigned long long bytes_received;
+            unsigned long long recv_calls;
+            Histogram histograms[NUM_HISTOGRAMS];
+        };
+    private:
+        Snapshot data_;
+    public:
+        Metrics() {
+            memset(&data_, 0, sizeof(data_));
+        }
+        /// the instance updated by Client
+        static Metrics & global() {
+            static Metrics metrics;
+            return metrics;
+        }
+        /// upper bound of the bucket in sec
+        static double bucket_bound(int i) {
+            static const double bounds[NUM_BUCKETS - 1] = {
+                0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+            };
+            return bounds[i];
+        }
+        static const char * histogram_name(int h) {
+            static const char *names[NUM_HISTOGRAMS] = {
+                "request_duration", "dns_duration", "connect_duration", "tls_duration", "wait_duration"
+            };
+            return names[h];
+        }
+        /// add an exchange
+        void record(bool ok, const Response::Timing &t) {
+            Metrics::add(&data_.requests, 1);
+            if (!ok) {
+                Metrics::add(&data_.errors, 1);
+            }
+            if (t.reused) {
+                Metrics::add(&data_.reused, 1);
+            } else if (t.connect_done > 0) {
+                Metrics::add(&data_.connections, 1);
+            }
+            Metrics::add(&data_.bytes_sent, t.bytes_sent);
+            Metrics::add(&data_.bytes_received, t.bytes_received);
+            Metrics::add(&data_.recv_calls, t.recv_calls);
+            this->observe(HISTOGRAM_DURATION, t.start, t.done);
+            this->observe(HISTOGRAM_DNS, t.connect_start, t.dns_done);
+            this->observe(HISTOGRAM_CONNECT, t.dns_done, t.connect_done);
+            this->observe(HISTOGRAM_TLS, t.connect_done, t.tls_done);
+            this->observe(HISTOGRAM_WAIT, t.request_sent, t.first_byte);
+        }
+        Snapshot snapshot() {
+            Snapshot snap;
+            unsigned long long *src = (unsigned long long *)&data_;
+            unsigned long long *dst = (unsigned long long *)&snap;
+            for (size_t i=0; i<sizeof(snap)/sizeof(*dst); i++) {
+                dst[i] = __sync_fetch_and_add(&src[i], 0);
+            }
+            return snap;
+        }
+        void reset() {
+            unsigned long long *p = (unsigned long long *)&data_;
+            for (size_t i=0; i<sizeof(data_)/sizeof(*p); i++) {
+                __sync_lock_test_and_set(&p[i], 0);
+            }
+        }
+        /// Prometheus text exposition format. the names are prefixed by "nanowww_".
+        std::string format() {
+            Snapshot snap = this->snapshot();
+            std::ostringstream os;
+            Metrics::counter(os, "requests_total", snap.requests);
+            Metrics::counter(os, "errors_total", snap.errors);
+            Metrics::counter(os, "connections_total", snap.connections);
+            Metrics::counter(os, "reused_connections_total", snap.reused);
+            Metrics::counter(os, "sent_bytes_total", snap.bytes_sent);
+            Metrics::counter(os, "received_bytes_total", snap.bytes_received);
+            Metrics::counter(os, "recv_calls_total", snap.recv_calls);
+            for (int h=0; h<NUM_HISTOGRAMS; h++) {
+                const Histogram &hist = snap.histograms[h];
+                std::string name = std::string("nanowww_") + histogram_name(h) + "_seconds";
+                os << "# TYPE " << name << " histogram\n";
+                unsigned long long cumulative = 0;
+                for (int i=0; i<NUM_BUCKETS; i++) {
+                    cumulative += hist.buckets[i];
+                    os << name << "_bucket{le=\"";
+                    if (i < NUM_BUCKETS - 1) {
+                        os << bucket_bound(i);
+                    } else {
+                        os << "+Inf";
+                    }
+                    os << "\"} " << cumulative << "\n";
+                }
+                os << name << "_sum " << hist.sum_usec / 1e6 << "\n";
+                os << name << "_count " << hist.count << "\n";
+            }
+            return os.str();
+        }
+    protected:
+        static inline void add(unsigned long long *p, unsigned long long n) {
+            __sync_fetch_and_add(p, n);
+        }
+        /// add end - begin, if both phases happened
+        void observe(int h, double begin, double end) {
+            if (begin <= 0 || end <= 0) {
+                return;
+            }
+            double sec = std::max(end - begin, 0.0);
+            int i = 0;
+            while (i < NUM_BUCKETS - 1 && sec > bucket_bound(i)) {
+                ++i;
+            }
+            Histogram &hist = data_.histograms[h];
+            Metrics::add(&hist.buckets[i], 1);
+            Metrics::add(&hist.count, 1);
+            Metrics::add(&hist.sum_usec, (unsigned long long)(sec * 1e6));
+        }
+        static void counter(std::ostream &os, const char *name, unsigned long long value) {
+            os << "# TYPE nanowww_" << name << " counter\n"
+               << "nanowww_" << name << " " << value << "\n";
+        }
+    };
+#endif
+
+    class Client {
+    private:
+        std::string errstr_;
+        unsigned int timeout_;
+        unsigned int connect_timeout_;
+        unsigned int first_byte_timeout_;
+        int max_redirects_;
+        nanouri::Uri proxy_url_;
+        bool keepalive_;
+        bool decode_content_;
+        DNSCache *dns_cache_;
+        unsigned int attempt_delay_;
+        unsigned int attempt_timeout_;
+        std::map<std::string, Address> last_peers_; // host => address won the last connect
+        size_t pipeline_depth_;
+        ResponseCache *cache_;
+#ifdef HAVE_SSL
+        ScopedPtr<TLSContext> tls_; // must outlive pool_
+        TLSContext *shared_tls_;
+#endif
+        ConnectionPool pool_;
+        SharedConnectionPool *shared_pool_;
+        std::string wbuf_; // serialized request header. reused.
+    public:
+        Client() {
+            timeout_ = 60; // default timeout is 60sec
+            connect_timeout_ = 0;
+            first_byte_timeout_ = 0;
+            max_redirects_ = 7; // default. same as LWP::UA
+            keepalive_ = false;
+            decode_content_ = false;
+            dns_cache_ = NULL;
+            attempt_delay_ = NANOWWW_CONNECTION_ATTEMPT_DELAY;
+            attempt_timeout_ = 0;
+            pipeline_depth_ = NANOWWW_DEFAULT_PIPELINE_DEPTH;
+            cache_ = NULL;
+#ifdef HAVE_SSL
+            shared_tls_ = NULL;
+#endif
+            shared_pool_ = NULL;
+        }
+        /**
+         * timeout of the whole request, including redirects.
+         * timeouts are applied to each socket operation by poll(2), so they
+         * work in threads. 0 means no timeout.
+         * @args tiemout: timeout in sec.
+         * @return none
+         */
+        inline void set_timeout(unsigned int timeout) {
+            timeout_ = timeout;
+        }
+        inline unsigned int timeout() { return timeout_; }
+        /// timeout for establishing the connection(and TLS handshake) in sec. 0 means same as timeout().
+        inline void set_connect_timeout(unsigned int timeout) {
+            connect_timeout_ = timeout;
+        }
+        inline unsigned int connect_timeout() { return connect_timeout_; }
+        /// timeout from sending the request to the first byte of response in sec. 0 means same as timeout().
+        inline void set_first_byte_timeout(unsigned int timeout) {
+            first_byte_timeout_ = timeout;
+        }
+        inline unsigned int first_byte_timeout() { return first_byte_timeout_; }
+        /**
+         * when the host has many addresses, they are tried in parallel("Happy Eyeballs").
+         * next address is tried if the connection isn't established in this msec.
+         */
+        inline void set_connection_attempt_delay(unsigned int msec) {
+            attempt_delay_ = msec;
+        }
+        inline unsigned int connection_attempt_delay() { return attempt_delay_; }
+        /// give up each address after this msec. 0 means no limit except connect_timeout().
+        inline void set_connection_attempt_timeout(unsigned int msec) {
+            attempt_timeout_ = msec;
+        }
+        inline unsigned int connection_attempt_timeout() { return attempt_timeout_; }
+
+        /// set proxy url
+        inline bool set_proxy(std::string &proxy_url) {
+            pool_.clear();
+            return proxy_url_.parse(proxy_url);
+        }
+        /// get proxy url
+        inline std::string proxy() {
+            return proxy_url_.as_string();
+        }
+        inline bool is_proxy() {
+            return proxy_url_;
+        }
+        /**
+         * use HTTP/1.1 persistent connections.
+         * idle connections are kept in pool() and reused for the same scheme/host/port.
+         */
+        inline void set_keepalive(bool keepalive) {
+            keepalive_ = keepalive;
+            if (!keepalive) {
+                pool_.clear();
+            }
+        }
+        inline bool keepalive() { return keepalive_; }
+        /// max requests in flight on the connection of send_pipelined()
+        inline void set_pipeline_depth(size_t depth) { pipeline_depth_ = depth > 0 ? depth : 1; }
+        inline size_t pipeline_depth() { return pipeline_depth_; }
+#ifdef HAVE_SSL
+        /**
+         * SSL_CTX and the TLS session cache shared by the https connections
+         * of this Client. see stats() for the full/resumed handshakes.
+         */
+        inline TLSContext * tls_context() {
+            if (shared_tls_) {
+                return shared_tls_;
+            }
+            if (!tls_.get()) {
+                tls_.reset(new TLSContext());
+            }
+            return tls_.get();
+        }
+        /**
+         * use the TLSContext shared with other Clients, instead of own one.
+         * it must outlive this Client and the pool which has its connections.
+         */
+        inline void set_tls_context(TLSContext *tls) { shared_tls_ = tls; }
+#endif
+        /// redirects(301/302/303/307/308) followed by one send_request(). 0 makes them an error.
+        inline int max_redirects() { return max_redirects_; }
+        inline void set_max_redirects(int mr) { max_redirects_ = mr; }
+        inline ConnectionPool * pool() { return &pool_; }
+        /**
+         * keep the idle connections in the pool shared with the Clients in
+         * other threads, instead of pool(). it must outlive this Client.
+         * NULL(default) means pool().
+         */
+        inline void set_shared_pool(SharedConnectionPool *pool) { shared_pool_ = pool; }
+        inline SharedConnectionPool * shared_pool() { return shared_pool_; }
+        /**
+         * send "Accept-Encoding: gzip, deflate" and decode the compressed body
+         * as it arrives. headers(Content-Encoding, Content-Length) are kept as sent.
+         * @return false if the binary is built without zlib
+         */
+        inline bool set_decode_content(bool decode) {
+#ifdef HAVE_ZLIB
+            decode_content_ = decode;
+            return true;
+#else
+            return !decode;
+#endif
+        }
+        inline bool decode_content() { return decode_content_; }
+        /**
+         * resolve host names through the cache. it can be shared with other
+         * Clients and threads, and must outlive this Client.
+         * NULL(default) means getaddrinfo(3) for each connection.
+         */
+        inline void set_dns_cache(DNSCache *cache) { dns_cache_ = cache; }
+        inline DNSCache * dns_cache() { return dns_cache_; }
+        /**
+         * cache the responses of send_request(req, res). it can be shared
+         * with other Clients and threads, and must outlive this Client.
+         * NULL(default) means no cache.
+         */
+        inline void set_cache(ResponseCache *cache) { cache_ = cache; }
+        inline ResponseCache * cache() { return cache_; }
+        /**
+         * @return string of latest error
+         */
+        inline std::string errstr() { return errstr_; }
+        inline int send_get(Response *res, const std::string &uri) {
+            return this->send_get(res, uri.c_str());
+        }
+        inline int send_get(Response *res, const char *uri) {
+            Request req("GET", uri, "");
+            return this->send_request(req, res);
+        }
+        inline int send_post(Response *res, const char *uri, std::map<std::string, std::string> &data) {
+            Request req("POST", uri, data);
+            return this->send_request(req, res);
+        }
+        inline int send_post(Response *res, const char *uri, const char *content) {
+            Request req("POST", uri, content);
+            return this->send_request(req, res);
+        }
+        inline int send_put(Response *res, const char *uri, const char *content) {
+            Request req("PUT", uri, content);
+            return this->send_request(req, res);
+        }
+        inline int send_delete(Response *res, const char *uri) {
+            Request req("DELETE", uri, "");
             return this->send_request(req, res);
         }
-        inline int send_post(Response *res, const char *uri, std::map<std::string, std::string> &data) {
-            Request req("POST", uri, data);
-            return this->send_request(req, res);
+        /**
+         * @return return true if success
+         */
+        inline bool send_request(Request &req, Response *res) {
+            if (cache_) {
+                return this->send_request_cached(req, res);
+            }
+            BufferingHandler handler(res);
+            return send_request_internal(req, res, &handler, Deadline::after(timeout_));
+        }
+        /**
+         * status and headers are stored in res, but the body is passed to
+         * the handler as it arrives. res->content() stays empty.
+         * @return return true if success
+         */
+        inline bool send_request(Request &req, Response *res, ResponseHandler *handler) {
+            return send_request_internal(req, res, handler, Deadline::after(timeout_));
+        }
+        /**
+         * send the requests to one scheme/host/port by HTTP/1.1 pipelining.
+         * up to pipeline_depth() requests are written back-to-back on one
+         * connection, and the responses are read in order from one buffer.
+         * if the server closes the connection before answering all of them,
+         * the unanswered requests are sent again on a new connection, so they
+         * must be idempotent(GET, HEAD, ...). redirects are not followed, and
+         * the bodies are not decoded. the timeout is for the whole batch.
+         * the connection is kept in pool() if keepalive() is set.
+         * @return number of the requests answered, in order. if it's less than
+         *         reqs.size(), errstr() tells why the next one failed.
+         */
+        size_t send_pipelined(const std::vector<Request*> &reqs, const std::vector<Response*> &res) {
+            assert(reqs.size() == res.size());
+            if (reqs.empty()) {
+                return 0;
+            }
+            std::string key = this->connection_key(*reqs[0]);
+            for (size_t i=1; i<reqs.size(); i++) {
+                if (this->connection_key(*reqs[i]) != key) {
+                    errstr_ = "pipelined requests must be sent to one host";
+                    return 0;
+                }
+            }
+            Deadline deadline = Deadline::after(timeout_);
+            size_t done = 0;
+            while (done < reqs.size()) {
+                size_t start = done;
+                bool reused;
+                int ret = this->pipeline_once(key, reqs, res, deadline, &done, &reused);
+                if (ret < 0) {
+                    break;
+                }
+                if (ret == 0 && done == start && !reused) {
+                    // fresh connection answered nothing. don't loop forever.
+                    if (errstr_.empty()) {
+                        errstr_ = "connection closed by server";
+                    }
+                    break;
+                }
+            }
+            return done;
+        }
+        /**
+         * write the body of 2xx response into fd, from its current position.
+         * res->content() stays empty. on Linux, plain HTTP bodies without
+         * decoding are moved by splice(2), and never copied to userspace.
+         * @return false on error, or if the status is not 2xx
+         */
+        bool save_to_fd(Request &req, Response *res, int fd) {
+            off_t offset = lseek(fd, 0, SEEK_CUR); // -1 for pipes and sockets
+            FileWriter writer(fd, offset);
+            bool ok = this->send_request(req, res, &writer);
+            if (offset >= 0) {
+                lseek(fd, offset + writer.written(), SEEK_SET);
+            }
+            if (!ok && !writer.errstr().empty()) {
+                errstr_ = writer.errstr();
+            }
+            return ok;
+        }
+        /// save_to_fd() into the file, created or truncated.
+        bool save_to_file(Request &req, Response *res, const char *path) {
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if (fd == -1) {
+                errstr_ = strerror(errno);
+                return false;
+            }
+            bool ok = this->save_to_fd(req, res, fd);
+            if (::close(fd) != 0 && ok) {
+                errstr_ = strerror(errno);
+                return false;
+            }
+            return ok;
+        }
+        /// port of the URI, or the default of its scheme if omitted
+        static short port_for(nanouri::Uri &uri) {
+            return uri.port() == 0
+                 ? (uri.scheme() == "https" ? 443 : 80)
+                 : uri.port();
+        }
+    protected:
+        std::string connection_key(Request &req) {
+            std::ostringstream key;
+            key << req.uri()->scheme() << "://" << req.uri()->host() << ":" << this->port_for(req);
+            if (proxy_url_) {
+                key << " via " << proxy_url_.as_string();
+            }
+            return key.str();
+        }
+        short port_for(Request &req) {
+            return Client::port_for(*req.uri());
+        }
+        Connection * connect(Request &req, const Deadline &deadline, Response::Timing *timing) {
+            ScopedPtr<Connection> sock;
+            if (req.uri()->scheme() == "http") {
+                sock.reset(new Connection());
+            } else {
+#ifdef HAVE_SSL
+                sock.reset(new TLSConnection(this->tls_context()));
+#else
+                errstr_ = "your binary donesn't supports SSL";
+                return NULL;
+#endif
+            }
+
+            sock->set_deadline(Deadline::min(deadline, Deadline::after(connect_timeout_)));
+            sock->set_timing(timing);
+            if (timing) {
+                timing->connect_start = monotonic_time();
+            }
+            sock->set_dns_cache(dns_cache_);
+            sock->set_attempt_delay(attempt_delay_ / 1000.0);
+            sock->set_attempt_timeout(attempt_timeout_ / 1000.0);
+            std::string host = proxy_url_ ? proxy_url_.host() : req.uri()->host();
+            short port = proxy_url_ ? proxy_url_.port() : this->port_for(req);
+            std::map<std::string, Address>::iterator last = last_peers_.find(host);
+            if (last != last_peers_.end()) {
+                sock->set_preferred_address(last->second);
+            }
+            if (!sock->connect(host.c_str(), port)) {
+                errstr_ = sock->errstr();
+                return NULL;
+            }
+            if (last == last_peers_.end() && last_peers_.size() >= NANOWWW_MAX_LAST_PEERS) {
+                last_peers_.erase(last_peers_.begin()); // make room for the new host
+            }
+            last_peers_[host] = sock->peer_address();
+
+            return sock.release();
+        }
+        /**
+         * puts the URI and the headers of the request back, when the
+         * redirects sent it to the new location.
+         */
+        class RedirectRestorer {
+            Request *req_;
+            std::string uri_;
+            Headers headers_;
+            bool saved_;
+        public:
+            RedirectRestorer(Request &req) : req_(&req), saved_(false) { }
+            ~RedirectRestorer() {
+                if (saved_) {
+                    req_->set_uri(uri_);
+                    *req_->headers() = headers_;
+                }
+            }
+            inline void save() {
+                if (!saved_) {
+                    uri_     = req_->uri()->as_string();
+                    headers_ = *req_->headers();
+                    saved_   = true;
+                }
+            }
+        };
+        /**
+         * send the request, following redirects up to max_redirects().
+         * 307/308 send req itself to the new location, and it's restored
+         * when this returns. the hops are in res->hops().
+         */
+        bool send_request_internal(Request &req, Response *res, ResponseHandler *handler, const Deadline &deadline) {
+            std::vector<Response::Hop> hops;
+            ScopedPtr<Request> redirected_req; // 301/302/303 to GET
+            RedirectRestorer restorer(req);
+            Request *cur = &req;
+            for (int remain_redirect = max_redirects_; ; --remain_redirect) {
+                res->reset();
+                Response::Hop hop;
+                hop.uri    = cur->uri()->as_string();
+                hop.reused = false;
+                double start = monotonic_time();
+#ifdef NANOWWW_ENABLE_TIMING
+                res->timing()->start = start;
+#endif
+                bool redirect = false;
+                bool ok = this->send_once(*cur, res, handler, deadline, &redirect, &hop.reused);
+                hop.status  = res->status();
+                hop.elapsed = monotonic_time() - start;
+                hops.push_back(hop);
+#ifdef NANOWWW_ENABLE_TIMING
+                res->timing()->done = start + hop.elapsed;
+                Metrics::global().record(ok, *res->timing());
+#endif
+                if (!ok || !redirect) {
+                    res->set_hops(hops);
+                    return ok;
+                }
+
+                if (remain_redirect <= 0) {
+                    errstr_ = "Redirect loop detected";
+                    res->set_hops(hops);
+                    return false;
+                }
+                if (cur == &req) {
+                    restorer.save();
+                }
+                Request *next = this->redirect_request(*cur, res, &redirected_req);
+                if (!next) {
+                    res->set_hops(hops);
+                    return false;
+                }
+                cur = next;
+            }
+        }
+        static bool is_redirect(int status) {
+            return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+        }
+        /**
+         * make the request for the next hop.
+         * 303(and 301/302 for POST) changes the method to GET and drops the body,
+         * as browsers do. others send the same request to the new location,
+         * so cur is changed. the credentials are dropped if the scheme, the
+         * host or the port is changed.
+         * @return NULL on error
+         */
+        Request * redirect_request(Request &cur, Response *res, ScopedPtr<Request> *holder) {
+            StringRef location = res->find_header("Location");
+            if (location.is_null()) {
+                errstr_ = "no Location header in redirect response";
+                return NULL;
+            }
+            std::string uri = resolve_uri(*cur.uri(), location.str());
+            nanouri::Uri parsed;
+            if (!parsed.parse(uri) || (parsed.scheme() != "http" && parsed.scheme() != "https")) {
+                errstr_ = "invalid Location header in redirect response";
+                return NULL;
+            }
+            bool origin_changed = parsed.scheme() != cur.uri()->scheme()
+                || parsed.host() != cur.uri()->host()
+                || this->port_for(parsed) != this->port_for(cur);
+
+            Request *next = &cur;
+            int status = res->status();
+            if ((status == 303 && cur.method() != "HEAD")
+                    || ((status == 301 || status == 302) && cur.method() == "POST")) {
+                ScopedPtr<Request> get(new Request("GET", uri.c_str()));
+                *get->headers() = *cur.headers();
+                get->headers()->remove_header("Content-Type");
+                get->headers()->remove_header("Content-Length");
+                get->headers()->remove_header("Transfer-Encoding");
+                holder->reset(get.release()); // cur may be the old *holder
+                next = holder->get();
+            } else {
+                next->set_uri(uri);
+            }
+            if (this->port_for(parsed) == (parsed.scheme() == "https" ? 443 : 80)) {
+                next->set_header("Host", parsed.host().c_str());
+            } else {
+                std::ostringstream host;
+                host << parsed.host() << ":" << parsed.port();
+                next->set_header("Host", host.str().c_str());
+            }
+            if (origin_changed) { // don't leak the credentials to other origins
+                next->headers()->remove_header("Authorization");
+                next->headers()->remove_header("Cookie");
+            }
+            return next;
+        }
+        inline Connection * checkout_idle(const std::string &key) {
+            return shared_pool_ ? shared_pool_->checkout(key) : pool_.checkout(key);
+        }
+        inline void checkin_idle(const std::string &key, Connection *sock) {
+            if (shared_pool_) {
+                shared_pool_->checkin(key, sock);
+            } else {
+                pool_.checkin(key, sock);
+            }
+        }
+        /**
+         * send_request() through cache_. a stale response is revalidated by
+         * the conditional request, and 304 makes it the response.
+         * redirected responses are not cached.
+         */
+        bool send_request_cached(Request &req, Response *res) {
+            if (!ResponseCache::is_cacheable_request(req)) {
+                BufferingHandler handler(res);
+                bool ok = send_request_internal(req, res, &handler, Deadline::after(timeout_));
+                const std::string &method = req.method();
+                if (ok && res->status() < 400 && method != "HEAD" && method != "OPTIONS" && method != "TRACE") {
+                    cache_->invalidate(req.uri()->as_string()); // unsafe method
+                }
+                return ok;
+            }
+            if (decode_content_ && !req.headers()->has_header("Accept-Encoding")) {
+                req.set_header("Accept-Encoding", "gzip, deflate"); // before lookup, for Vary
+            }
+            Response stale;
+            ResponseCache::State state = cache_->lookup(req, res);
+            if (state == ResponseCache::FRESH) {
+                return true;
+            }
+            if (state == ResponseCache::STALE) {
+                stale = *res;
+                if (stale.headers()->has_header("ETag")) {
+                    req.set_header("If-None-Match", stale.get_header("ETag").c_str());
+                }
+                if (stale.headers()->has_header("Last-Modified")) {
+                    req.set_header("If-Modified-Since", stale.get_header("Last-Modified").c_str());
+                }
+            }
+            BufferingHandler handler(res);
+            bool ok = send_request_internal(req, res, &handler, Deadline::after(timeout_));
+            if (state == ResponseCache::STALE) {
+                req.headers()->remove_header("If-None-Match");
+                req.headers()->remove_header("If-Modified-Since");
+            }
+            if (ok && res->hops().size() == 1) {
+                cache_->update(req, res, state == ResponseCache::STALE ? &stale : NULL);
+            }
+            return ok;
+        }
+        /**
+         * one request/response exchange.
+         * if the response is a redirect, its body is discarded, the handler
+         * is not called, and *redirect is set.
+         */
+        bool send_once(Request &req, Response *res, ResponseHandler *handler, const Deadline &deadline, bool *redirect, bool *reused_out) {
+            req.set_protocol(keepalive_ ? "HTTP/1.1" : "HTTP/1.0");
+            if (decode_content_ && !req.headers()->has_header("Accept-Encoding")) {
+                req.set_header("Accept-Encoding", "gzip, deflate");
+            }
+            std::string key = this->connection_key(req);
+
+            ScopedPtr<Connection> sock;
+            bool reused = false;
+            std::string buf;
+            char read_buf[NANOWWW_READ_BUFFER_SIZE];
+            int minor_version;
+            size_t header_len = 0;
+            Response::Timing *timing = res->timing(); // NULL unless NANOWWW_ENABLE_TIMING
+
+            // when the reused connection was closed by server before we get any response,
+            // retry it with fresh connection, if the request can be sent again.
+            while (1) {
+                sock.reset(keepalive_ ? this->checkout_idle(key) : NULL);
+                reused = sock.get() != NULL;
+                if (!reused) {
+                    sock.reset(this->connect(req, deadline, timing));
+                    if (!sock.get()) {
+                        return false;
+                    }
+                } else {
+                    sock->set_timing(timing);
+                }
+
+                sock->set_deadline(deadline);
+                if (!req.write_request(*sock, this->is_proxy(), &wbuf_)) {
+                    if (reused && req.can_resend()) { continue; }
+                    errstr_ = "error in writing request";
+                    return false;
+                }
+                if (timing) {
+                    timing->request_sent = monotonic_time();
+                }
+
+                // read header part
+                sock->set_deadline(Deadline::min(deadline, Deadline::after(first_byte_timeout_)));
+                int nread = 0;
+                while (1) {
+                    nread = sock->recv(read_buf, sizeof(read_buf));
+                    if (nread <= 0) {
+                        break;
+                    }
+                    size_t last_len = buf.size();
+                    buf.append(read_buf, nread);
+                    sock->set_deadline(deadline);
+                    if (timing && last_len == 0) {
+                        timing->first_byte = monotonic_time();
+                    }
+
+                    int ret = res->parse_header(buf.c_str(), buf.size(), last_len, &minor_version);
+                    if (ret > 0) {
+                        header_len = ret;
+                        break;
+                    } else if (ret == -1) { // parse error
+                        errstr_ = "http response parse error";
+                        return false;
+                    } else if (ret == -2) { // request is partial
+                        continue;
+                    }
+                }
+                if (nread > 0) {
+                    break;
+                }
+                int err = errno;
+                if (reused && buf.empty() && (nread == 0 || err == ECONNRESET) && req.can_resend()) {
+                    continue;
+                }
+                if (nread == 0) { // eof
+                    errstr_ = "EOF";
+                } else { // error
+                    errstr_ = strerror(err);
+                }
+                return false;
+            }
+
+            *reused_out = reused;
+            if (timing) {
+                timing->reused = reused;
+            }
+
+            // the body of redirect response is read to keep the connection, and thrown away.
+            DiscardingHandler discard;
+            *redirect = is_redirect(res->status());
+            if (*redirect) {
+                handler = &discard;
+            } else if (!handler->on_header(*res)) {
+                errstr_ = "aborted by handler";
+                return false;
+            }
+
+#ifdef HAVE_ZLIB
+            InflatingHandler::Encoding encoding = decode_content_ && !*redirect
+                ? InflatingHandler::detect(res) : InflatingHandler::ENCODING_NONE;
+            ScopedPtr<InflatingHandler> inflater;
+            if (encoding != InflatingHandler::ENCODING_NONE) {
+                inflater.reset(new InflatingHandler(handler, encoding));
+                handler = inflater.get();
+            }
+#endif
+
+            // read body part
+            size_t content_length;
+            BodyReader::Mode mode = BodyReader::detect(req.method(), res, &content_length);
+            BodyReader reader;
+            reader.init(mode, content_length);
+            if (reader.mode() == BodyReader::MODE_LENGTH) {
+                handler->on_content_length(content_length);
+            }
+            // body bytes received with the header
+            ssize_t consumed = reader.feed(buf.c_str() + header_len, buf.size() - header_len, handler);
+            if (consumed < 0) {
+                errstr_ = consumed == -1 ? "broken chunked encoding" : "aborted by handler";
+#ifdef HAVE_ZLIB
+                if (inflater.get() && inflater->is_error()) { errstr_ = inflater->errstr(); }
+#endif
+                return false;
+            }
+            size_t leftover = buf.size() - header_len - consumed;
+            bool direct = true; // try splice(2) while the handler wants it
+            while (!reader.is_done()) {
+                off_t offset;
+                int fd = direct && reader.direct_size() > 0 ? handler->splice_fd(&offset) : -1;
+                int nread;
+                if (fd >= 0) {
+                    nread = sock->splice_to(fd, offset < 0 ? NULL : &offset,
+                        std::min(reader.direct_size(), (size_t)NANOWWW_SPLICE_SIZE));
+                    if (nread < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                        direct = false; // TLS, or not supported for the fd
+                        continue;
+                    }
+                } else {
+                    nread = sock->recv(read_buf, reader.wanted(sizeof(read_buf)));
+                }
+                if (nread == 0) { // eof
+                    if (!reader.finish_on_eof()) {
+                        errstr_ = "unexpected EOF while reading body";
+                        return false;
+                    }
+                    break;
+                } else if (nread < 0) { // error
+                    errstr_ = strerror(errno);
+                    return false;
+                }
+                if (fd >= 0) {
+                    reader.skip_direct(nread);
+                    leftover = 0;
+                    if (!handler->on_spliced(nread)) {
+                        errstr_ = "aborted by handler";
+                        return false;
+                    }
+                    continue;
+                }
+                consumed = reader.feed(read_buf, nread, handler);
+                if (consumed < 0) {
+                    errstr_ = consumed == -1 ? "broken chunked encoding" : "aborted by handler";
+#ifdef HAVE_ZLIB
+                    if (inflater.get() && inflater->is_error()) { errstr_ = inflater->errstr(); }
+#endif
+                    return false;
+                }
+                leftover = nread - consumed;
+            }
+#ifdef HAVE_ZLIB
+            if (inflater.get() && !inflater->is_finished()) {
+                errstr_ = "unexpected end of compressed body";
+                return false;
+            }
+#endif
+            if (!*redirect) {
+                handler->on_complete(*res);
+            }
+
+            // the connection is clean only if the server sent nothing after the body.
+            if (keepalive_ && leftover == 0 && reader.is_self_delimited()
+                    && this->is_persistent(res, minor_version)) {
+                this->checkin_idle(key, sock.release());
+                return true;
+            }
+
+            sock->close();
+            return true;
+        }
+        /**
+         * send reqs[*done...] on one connection, and read the responses.
+         * @return 1 if all of them are answered, 0 if the connection is closed
+         *         and the rest should be sent again, -1 on error.
+         */
+        int pipeline_once(const std::string &key, const std::vector<Request*> &reqs,
+                          const std::vector<Response*> &res, const Deadline &deadline,
+                          size_t *done, bool *reused) {
+            errstr_.clear();
+            ScopedPtr<Connection> sock(this->checkout_idle(key));
+            *reused = sock.get() != NULL;
+            if (!*reused) {
+                sock.reset(this->connect(*reqs[*done], deadline, NULL));
+                if (!sock.get()) {
+                    return -1;
+                }
+            }
+            sock->set_deadline(deadline);
+
+            std::vector<std::string> header_bufs(pipeline_depth_);
+            std::string buf;  // responses not parsed yet
+            size_t pos = 0;   // parsed part of buf
+            char read_buf[NANOWWW_READ_BUFFER_SIZE];
+            size_t sent = *done;
+            while (*done < reqs.size()) {
+                // refill the pipeline when half of it is answered
+                size_t in_flight = sent - *done;
+                if (sent < reqs.size() && in_flight <= pipeline_depth_ / 2) {
+                    WriteBatch batch(*sock);
+                    for (size_t i=0; sent < reqs.size() && in_flight + i < pipeline_depth_; ++i, ++sent) {
+                        reqs[sent]->set_protocol("HTTP/1.1");
+                        if (!reqs[sent]->push_request(batch, this->is_proxy(), &header_bufs[i])) {
+                            return 0; // maybe closed by server
+                        }
+                    }
+                    if (!batch.flush()) {
+                        return 0;
+                    }
+                }
+
+                Response *r = res[*done];
+                r->reset();
+                int minor_version;
+                int header_len = -2;
+                while (1) {
+                    if (pos < buf.size()) {
+                        header_len = r->parse_header(buf.c_str() + pos, buf.size() - pos, 0, &minor_version);
+                        if (header_len != -2) {
+                            break;
+                        }
+                    }
+                    int ret = this->pipeline_recv(*sock, &buf, &pos, read_buf, sizeof(read_buf));
+                    if (ret <= 0) {
+                        return ret;
+                    }
+                }
+                if (header_len == -1) {
+                    errstr_ = "http response parse error";
+                    return -1;
+                }
+                pos += header_len;
+
+                BufferingHandler handler(r);
+                size_t content_length;
+                BodyReader::Mode mode = BodyReader::detect(reqs[*done]->method(), r, &content_length);
+                BodyReader reader;
+                reader.init(mode, content_length);
+                if (reader.mode() == BodyReader::MODE_LENGTH) {
+                    handler.on_content_length(content_length);
+                }
+                while (1) {
+                    ssize_t consumed = reader.feed(buf.c_str() + pos, buf.size() - pos, &handler);
+                    if (consumed < 0) {
+                        errstr_ = "broken chunked encoding";
+                        return -1;
+                    }
+                    pos += consumed;
+                    if (reader.is_done()) {
+                        break;
+                    }
+                    int ret = this->pipeline_recv(*sock, &buf, &pos, read_buf, sizeof(read_buf));
+                    if (ret < 0) {
+                        return ret;
+                    }
+                    if (ret == 0) {
+                        if (!reader.finish_on_eof()) {
+                            return 0; // answer this one again
+                        }
+                        break;
+                    }
+                }
+                ++*done;
+                if (!reader.is_self_delimited() || !this->is_persistent(r, minor_version)) {
+                    return *done == reqs.size() ? 1 : 0; // the rest goes to a new connection
+                }
+            }
+            if (keepalive_ && pos == buf.size()) {
+                this->checkin_idle(key, sock.release());
+            }
+            return 1;
+        }
+        /**
+         * read more responses into *buf. the parsed part is dropped.
+         * @return 1 if read, 0 if the connection is closed, -1 on error.
+         */
+        int pipeline_recv(Connection &sock, std::string *buf, size_t *pos, char *read_buf, size_t size) {
+            int nread = sock.recv(read_buf, size);
+            if (nread == 0 || (nread < 0 && (errno == ECONNRESET || errno == EPIPE))) {
+                return 0;
+            }
+            if (nread < 0) {
+                errstr_ = strerror(errno);
+                return -1;
+            }
+            buf->erase(0, *pos);
+            *pos = 0;
+            buf->append(read_buf, nread);
+            return 1;
+        }
+        /**
+         * connection can be reused if server agreed to keep it alive.
+         */
+        bool is_persistent(Response *res, int minor_version) {
+            StringRef conn = res->find_header("Connection");
+            if (!conn.is_null()) {
+                if (conn.equals_nocase("close")) {
+                    return false;
+                }
+                if (minor_version == 0 && !conn.equals_nocase("keep-alive")) {
+                    return false;
+                }
+            } else if (minor_version == 0) {
+                return false;
+            }
+            return true;
+        }
+    };
+
+    /**
+     * Client which can be shared by threads. the settings are fixed at
+     * construction, and the error is returned for each request instead of
+     * errstr(). each thread sends by its own Client with the settings, and
+     * they share the idle connections(SharedConnectionPool) and TLS sessions.
+     *
+     *   nanowww::SharedClient::Config config;
+     *   config.timeout   = 10;
+     *   config.keepalive = true;
+     *   nanowww::SharedClient www(config);
+     *
+     *   // in any thread
+     *   std::string error;
+     *   if (!www.send_request(req, &res, &error)) { ... }
+     *
+     * destroy it after the threads which sent by it have exited(joined), or
+     * while they are alive but don't use it any more. a thread exiting
+     * during the destruction frees its Client in SharedClient, and it
+     * can't be made safe here.
+     */
+    class SharedClient {
+    public:
+        /// same as the setters of Client
+        struct Config {
+            unsigned int timeout;
+            unsigned int connect_timeout;
+            unsigned int first_byte_timeout;
+            int max_redirects;
+            std::string proxy;
+            bool keepalive;
+            bool decode_content;
+            DNSCache *dns_cache;     // shared. must outlive the SharedClient
+            ResponseCache *cache;    // same as above
+            unsigned int connection_attempt_delay;
+            unsigned int connection_attempt_timeout;
+            size_t pipeline_depth;
+            size_t pool_shards;      // see SharedConnectionPool
+            size_t max_idle;         // for each shard
+            unsigned int idle_timeout;
+            Config() {
+                Client defaults;
+                timeout                    = defaults.timeout();
+                connect_timeout            = defaults.connect_timeout();
+                first_byte_timeout         = defaults.first_byte_timeout();
+                max_redirects              = defaults.max_redirects();
+                keepalive                  = defaults.keepalive();
+                decode_content             = defaults.decode_content();
+                dns_cache                  = NULL;
+                cache                      = NULL;
+                connection_attempt_delay   = defaults.connection_attempt_delay();
+                connection_attempt_timeout = defaults.connection_attempt_timeout();
+                pipeline_depth             = defaults.pipeline_depth();
+                pool_shards                = NANOWWW_POOL_SHARDS;
+                max_idle                   = NANOWWW_DEFAULT_MAX_IDLE_CONNECTIONS;
+                idle_timeout               = NANOWWW_DEFAULT_IDLE_TIMEOUT;
+            }
+        };
+    private:
+        struct Local {
+            SharedClient *owner;
+            Client client;
+        };
+        const Config config_;
+        std::string config_error_; // set if the config is invalid
+#ifdef HAVE_SSL
+        TLSContext tls_; // must outlive pool_
+#endif
+        SharedConnectionPool pool_;
+        pthread_key_t key_;
+        Mutex mutex_;
+        std::set<Local*> locals_; // Clients of the threads
+        SharedClient(const SharedClient &);
+        SharedClient & operator=(const SharedClient &);
+    public:
+        explicit SharedClient(const Config &config=Config())
+            : config_(config), pool_(config.pool_shards, config.max_idle) {
+            pool_.set_idle_timeout(config.idle_timeout);
+            nanouri::Uri proxy;
+            if (!config.proxy.empty() && !proxy.parse(config.proxy)) {
+                config_error_ = "invalid proxy url: " + config.proxy;
+            }
+            if (config.decode_content && !Client().set_decode_content(true)) {
+                config_error_ = "your binary doesn't support decode_content";
+            }
+            pthread_key_create(&key_, SharedClient::release);
+        }
+        /// no thread may use it, or be exiting. see above.
+        ~SharedClient() {
+            pthread_key_delete(key_); // release() isn't called for the living threads after this
+            ScopedLock lock(mutex_);
+            for (std::set<Local*>::iterator iter = locals_.begin(); iter != locals_.end(); ++iter) {
+                delete *iter;
+            }
+            locals_.clear();
+        }
+        inline const Config & config() const { return config_; }
+        inline SharedConnectionPool * pool() { return &pool_; }
+#ifdef HAVE_SSL
+        inline TLSContext * tls_context() { return &tls_; }
+#endif
+
+        /**
+         * same as Client::send_request().
+         * @args error: set to the reason if it fails. can be NULL.
+         * @return true if success
+         */
+        bool send_request(Request &req, Response *res, std::string *error=NULL) {
+            Client *client = this->client(error);
+            if (!client) {
+                return false;
+            }
+            bool ok = client->send_request(req, res);
+            if (!ok && error) {
+                *error = client->errstr();
+            }
+            return ok;
+        }
+        /// same as Client::send_request() with the handler
+        bool send_request(Request &req, Response *res, ResponseHandler *handler, std::string *error=NULL) {
+            Client *client = this->client(error);
+            if (!client) {
+                return false;
+            }
+            bool ok = client->send_request(req, res, handler);
+            if (!ok && error) {
+                *error = client->errstr();
+            }
+            return ok;
+        }
+        inline bool send_get(Response *res, const std::string &uri, std::string *error=NULL) {
+            Request req("GET", uri.c_str(), "");
+            return this->send_request(req, res, error);
+        }
+        /// same as Client::save_to_file()
+        bool save_to_file(Request &req, Response *res, const char *path, std::string *error=NULL) {
+            Client *client = this->client(error);
+            if (!client) {
+                return false;
+            }
+            bool ok = client->save_to_file(req, res, path);
+            if (!ok && error) {
+                *error = client->errstr();
+            }
+            return ok;
+        }
+        /**
+         * same as Client::send_pipelined().
+         * @args error: the reason why the next one of the answered failed
+         */
+        size_t send_pipelined(const std::vector<Request*> &reqs, const std::vector<Response*> &res,
+                              std::string *error=NULL) {
+            Client *client = this->client(error);
+            if (!client) {
+                return 0;
+            }
+            size_t done = client->send_pipelined(reqs, res);
+            if (done < reqs.size() && error) {
+                *error = client->errstr();
+            }
+            return done;
+        }
+    protected:
+        /// Client of the calling thread
+        Client * client(std::string *error) {
+            if (!config_error_.empty()) {
+                if (error) {
+                    *error = config_error_;
+                }
+                return NULL;
+            }
+            Local *local = (Local *)pthread_getspecific(key_);
+            if (local) {
+                return &local->client;
+            }
+            local = new Local();
+            local->owner = this;
+            Client &c = local->client;
+            c.set_timeout(config_.timeout);
+            c.set_connect_timeout(config_.connect_timeout);
+            c.set_first_byte_timeout(config_.first_byte_timeout);
+            c.set_max_redirects(config_.max_redirects);
+            if (!config_.proxy.empty()) {
+                std::string proxy = config_.proxy;
+                c.set_proxy(proxy);
+            }
+            c.set_keepalive(config_.keepalive);
+            c.set_decode_content(config_.decode_content);
+            c.set_dns_cache(config_.dns_cache);
+            c.set_cache(config_.cache);
+            c.set_connection_attempt_delay(config_.connection_attempt_delay);
+            c.set_connection_attempt_timeout(config_.connection_attempt_timeout);
+            c.set_pipeline_depth(config_.pipeline_depth);
+            c.set_shared_pool(&pool_);
+#ifdef HAVE_SSL
+            c.set_tls_context(&tls_);
+#endif
+            {
+                ScopedLock lock(mutex_);
+                locals_.insert(local);
+            }
+            pthread_setspecific(key_, local);
+            return &c;
+        }
+        /// destructor of the thread-specific data
+        /// destructor of the thread-specific data, at the exit of the thread.
+        static void release(void *arg) {
+            Local *local = (Local *)arg;
+            {
+                ScopedLock lock(local->owner->mutex_);
+                local->owner->locals_.erase(local);
+            }
+            delete local;
+        }
+    };
+
+    /**
+     * runs batches of requests on a fixed pool of worker threads, by
+     * SharedClient::send_request(). the requests are dealt to the workers'
+     * queues, and an idle worker steals from the others. requests to one
+     * scheme/host/port run at most max_per_host at once; the rest wait for
+     * a finished one of the host, while the worker goes on with others.
+     *
+     *   nanowww::BatchExecutor executor(8, 4); // 8 threads, 4 per host
+     *   std::vector<nanowww::BatchExecutor::Result> results;
+     *   executor.run(reqs, &results);
+     *   if (!results[0].ok) { std::cerr << results[0].error; }
+     */
+    class BatchExecutor {
+    public:
+        /// outcome of each request
+        struct Result {
+            bool ok;
+            std::string error;
+            Response response;
+        };
+        /// called in a worker thread as each request is done. it must be thread-safe.
+        class Callback {
+        public:
+            virtual ~Callback() { }
+            virtual void on_complete(size_t index, Request &req, Result &result) = 0;
+        };
+    protected:
+        struct Queue {
+            Mutex mutex;
+            std::deque<size_t> tasks; // indexes of the requests
+            char pad[64]; // keep the locks on different cache lines
+        };
+        struct Worker {
+            BatchExecutor *self;
+            size_t id;
+            pthread_t thread;
+        };
+        SharedClient client_;
+        size_t max_per_host_;
+        std::vector<Queue*> queues_;
+        std::vector<Worker> workers_;
+        std::string errstr_;
+        Mutex run_mutex_; // one batch at a time
+        // the batch. guarded by mutex_
+        Mutex mutex_;
+        pthread_cond_t work_cond_;
+        pthread_cond_t done_cond_;
+        bool stop_;
+        volatile size_t pending_; // in the queues
+        size_t remaining_;        // not finished
+        const std::vector<Request*> *reqs_;
+        std::vector<Result> *results_;
+        Callback *callback_;
+        std::map<std::string, size_t> active_;               // host => running requests
+        std::map<std::string, std::deque<size_t> > waiting_; // host => over the limit
+        BatchExecutor(const BatchExecutor &);
+        BatchExecutor & operator=(const BatchExecutor &);
+    public:
+        /**
+         * @args threads: number of the workers
+         * @args max_per_host: requests to one host at once. 0 means no limit.
+         * @args config: settings of the requests
+         */
+        BatchExecutor(size_t threads=NANOWWW_BATCH_THREADS, size_t max_per_host=0,
+                      const SharedClient::Config &config=SharedClient::Config())
+                : client_(config), max_per_host_(max_per_host) {
+            pthread_cond_init(&work_cond_, NULL);
+            pthread_cond_init(&done_cond_, NULL);
+            stop_      = false;
+            pending_   = 0;
+            remaining_ = 0;
+            reqs_      = NULL;
+            results_   = NULL;
+            callback_  = NULL;
+            threads = threads > 0 ? threads : 1;
+            workers_.resize(threads);
+            for (size_t i=0; i<threads; i++) {
+                queues_.push_back(new Queue());
+            }
+            for (size_t i=0; i<threads; i++) {
+                workers_[i].self = this;
+                workers_[i].id   = i;
+                int err = pthread_create(&workers_[i].thread, NULL, BatchExecutor::worker_main, &workers_[i]);
+                if (err != 0) {
+                    // go on with the started ones. they steal from the queues without a worker.
+                    errstr_ = strerror(err);
+                    workers_.resize(i);
+                    break;
+                }
+            }
+        }
+        ~BatchExecutor() {
+            {
+                ScopedLock lock(mutex_);
+                stop_ = true;
+                pthread_cond_broadcast(&work_cond_);
+            }
+            for (size_t i=0; i<workers_.size(); i++) {
+                pthread_join(workers_[i].thread, NULL);
+            }
+            for (size_t i=0; i<queues_.size(); i++) {
+                delete queues_[i];
+            }
+            pthread_cond_destroy(&work_cond_);
+            pthread_cond_destroy(&done_cond_);
+        }
+        /// number of the running workers. it's less than requested if some couldn't be started.
+        inline size_t threads() { return workers_.size(); }
+        /// why the workers couldn't be started, or empty
+        inline const std::string & errstr() { return errstr_; }
+        inline size_t max_per_host() { return max_per_host_; }
+        inline SharedClient * client() { return &client_; }
+
+        /**
+         * send the requests, and wait for all of them.
+         * @args results: resized to reqs.size(), in the order of reqs
+         * @args callback: called as each request is done. can be NULL.
+         * @return number of the succeeded requests
+         */
+        size_t run(const std::vector<Request*> &reqs, std::vector<Result> *results, Callback *callback=NULL) {
+            ScopedLock run_lock(run_mutex_);
+            results->clear();
+            results->resize(reqs.size());
+            if (reqs.empty()) {
+                return 0;
+            }
+            if (workers_.empty()) { // nobody runs them
+                for (size_t i=0; i<results->size(); i++) {
+                    (*results)[i].ok    = false;
+                    (*results)[i].error = errstr_;
+                }
+                return 0;
+            }
+            {
+                ScopedLock lock(mutex_);
+                reqs_      = &reqs;
+                results_   = results;
+                callback_  = callback;
+                remaining_ = reqs.size();
+                // deal contiguous blocks, so the workers steal from the far end
+                size_t n = queues_.size();
+                for (size_t i=0; i<n; i++) {
+                    ScopedLock queue_lock(queues_[i]->mutex);
+                    for (size_t j = reqs.size() * i / n; j < reqs.size() * (i + 1) / n; j++) {
+                        queues_[i]->tasks.push_back(j);
+                    }
+                }
+                __sync_add_and_fetch(&pending_, reqs.size());
+                pthread_cond_broadcast(&work_cond_);
+                while (remaining_ > 0) {
+                    pthread_cond_wait(&done_cond_, mutex_.get());
+                }
+                reqs_     = NULL;
+                results_  = NULL;
+                callback_ = NULL;
+            }
+            size_t ok = 0;
+            for (size_t i=0; i<results->size(); i++) {
+                ok += (*results)[i].ok ? 1 : 0;
+            }
+            return ok;
+        }
+    protected:
+        static void * worker_main(void *arg) {
+            Worker *w = (Worker *)arg;
+            w->self->work(w->id);
+            return NULL;
+        }
+        void work(size_t id) {
+            while (1) {
+                size_t index;
+                if (this->take(id, &index)) {
+                    this->execute(index);
+                    continue;
+                }
+                ScopedLock lock(mutex_);
+                while (!stop_ && pending_ == 0) {
+                    pthread_cond_wait(&work_cond_, mutex_.get());
+                }
+                if (stop_) {
+                    return;
+                }
+            }
+        }
+        /// pop the front of own queue, or steal the back of another
+        bool take(size_t id, size_t *index) {
+            for (size_t i=0; i<queues_.size(); i++) {
+                Queue *q = queues_[(id + i) % queues_.size()];
+                ScopedLock lock(q->mutex);
+                if (q->tasks.empty()) {
+                    continue;
+                }
+                if (i == 0) {
+                    *index = q->tasks.front();
+                    q->tasks.pop_front();
+                } else {
+                    *index = q->tasks.back();
+                    q->tasks.pop_back();
+                }
+                __sync_sub_and_fetch(&pending_, 1);
+                return true;
+            }
+            return false;
+        }
+        /// run the request, and the waiting ones of the host after it
+        void execute(size_t index) {
+            std::string host = this->host_key(*(*reqs_)[index]);
+            {
+                ScopedLock lock(mutex_);
+                size_t &active = active_[host];
+                if (max_per_host_ > 0 && active >= max_per_host_) {
+                    waiting_[host].push_back(index); // run by the one finishes first
+                    return;
+                }
+                ++active;
+            }
+            while (1) {
+                Request &req = *(*reqs_)[index];
+                Result &result = (*results_)[index];
+                result.error.clear();
+                result.ok = client_.send_request(req, &result.response, &result.error);
+                if (callback_) {
+                    callback_->on_complete(index, req, result);
+                }
+
+                ScopedLock lock(mutex_);
+                if (--remaining_ == 0) {
+                    pthread_cond_signal(&done_cond_);
+                }
+                std::map<std::string, std::deque<size_t> >::iterator waiting = waiting_.find(host);
+                if (waiting != waiting_.end()) {
+                    index = waiting->second.front(); // hand over the slot
+                    waiting->second.pop_front();
+                    if (waiting->second.empty()) {
+                        waiting_.erase(waiting);
+                    }
+                    continue;
+                }
+                if (--active_[host] == 0) {
+                    active_.erase(host);
+                }
+                return;
+            }
         }
-        inline int send_post(Response *res, const char *uri, const char *content) {
-            Request req("POST", uri, content);
-            return this->send_request(req, res);
+        static std::string host_key(Request &req) {
+            std::ostringstream key;
+            key << req.uri()->scheme() << "://" << req.uri()->host() << ":" << Client::port_for(*req.uri());
+            return key.str();
         }
-        inline int send_put(Response *res, const char *uri, const char *content) {
-            Request req("PUT", uri, content);
-            return this->send_request(req, res);
+    };
+
+    /**
+     * downloads a large resource into a file over several connections.
+     * the size is probed by HEAD, and byte ranges are fetched in parallel
+     * by worker threads, each writing at its offset of the preallocated file.
+     * a failed range is retried from where it stopped.
+     * if the server doesn't send "Accept-Ranges: bytes" and Content-Length,
+     * the body is downloaded by one GET.
+     *
+     *   nanowww::Downloader dl;
+     *   dl.set_connections(8);
+     *   if (!dl.download("http://example.com/big.iso", "big.iso")) {
+     *       std::cerr << dl.errstr() << std::endl;
+     *   }
+     */
+    class Downloader {
+    protected:
+        struct Range {
+            unsigned long long offset;
+            unsigned long long length;
+            int retries;
+        };
+        struct Job {
+            Downloader *self;
+            Request *base;      // headers to send
+            std::string uri;    // the final URI of the probe
+            std::string validator; // If-Range
+            int fd;
+            Mutex mutex;
+            std::list<Range> queue;
+            volatile int failed;
+            std::string errstr;
+        };
+        std::string errstr_;
+        unsigned int connections_;
+        unsigned long long chunk_size_;
+        int max_retries_;
+        unsigned int timeout_;
+        nanouri::Uri proxy_url_;
+        DNSCache *dns_cache_;
+        unsigned long long size_;
+        bool ranged_;
+        unsigned long long retries_;
+    public:
+        Downloader() {
+            connections_ = 4;
+            chunk_size_  = 8 * 1024 * 1024;
+            max_retries_ = 3;
+            timeout_     = 60;
+            dns_cache_   = NULL;
+            size_        = 0;
+            ranged_      = false;
+            retries_     = 0;
         }
-        inline int send_delete(Response *res, const char *uri) {
-            Request req("DELETE", uri, "");
-            return this->send_request(req, res);
+        /// number of parallel connections(threads)
+        inline void set_connections(unsigned int n) { connections_ = n > 0 ? n : 1; }
+        inline unsigned int connections() { return connections_; }
+        /// bytes fetched by one range request
+        inline void set_chunk_size(unsigned long long size) { chunk_size_ = size > 0 ? size : 1; }
+        inline unsigned long long chunk_size() { return chunk_size_; }
+        /// retries of each range, before giving up the whole download
+        inline void set_max_retries(int n) { max_retries_ = n; }
+        inline int max_retries() { return max_retries_; }
+        /// timeout of each request in sec. same as Client::set_timeout()
+        inline void set_timeout(unsigned int timeout) { timeout_ = timeout; }
+        inline unsigned int timeout() { return timeout_; }
+        inline bool set_proxy(const std::string &proxy_url) { return proxy_url_.parse(proxy_url); }
+        inline void set_dns_cache(DNSCache *cache) { dns_cache_ = cache; }
+
+        inline std::string errstr() { return errstr_; }
+        /// bytes of the last download
+        inline unsigned long long size() { return size_; }
+        /// true if the last download was done by range requests
+        inline bool ranged() { return ranged_; }
+        /// range requests retried in the last download
+        inline unsigned long long retries() { return retries_; }
+
+        bool download(const char *uri, const char *path) {
+            Request req("GET", uri);
+            return this->download(req, path);
         }
         /**
-         * @return return true if success
+         * download the URI of req into path. the headers of req(e.g. Authorization)
+         * are sent with every request, and the method is ignored.
+         * path is truncated first.
+         * @return false on error
          */
-        inline bool send_request(Request &req, Response *res) {
-            return send_request_internal(req, res, this->max_redirects_);
-        }
-    protected:
-        bool send_request_internal(Request &req, Response *res, int remain_redirect) {
-            nanoalarm::Alarm alrm(this->timeout_); // RAII
+        bool download(Request &req, const char *path) {
+            size_     = 0;
+            ranged_   = false;
+            retries_  = 0;
 
-            std::auto_ptr<nanosocket::Socket> sock;
-            if (req.uri()->scheme() == "http") {
-                nanosocket::Socket *p = new nanosocket::Socket();
-                sock.reset(p);
+            // probe
+            Client client;
+            this->setup(&client);
+            Request head("HEAD", req.uri()->as_string().c_str());
+            *head.headers() = *req.headers();
+            head.set_header("Host", head.uri()->host().c_str());
+            Response res;
+            bool ok = client.send_request(head, &res); // head follows redirects
+            // the ranges go to the final URI. head itself is put back to the first one.
+            std::string uri = ok ? res.hops().back().uri : req.uri()->as_string();
+
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if (fd == -1) {
+                errstr_ = strerror(errno);
+                return false;
+            }
+            unsigned long long length = 0;
+            StringRef content_length = res.find_header("Content-Length");
+            StringRef accept_ranges  = res.find_header("Accept-Ranges");
+            if (ok && res.status() == 200 && !content_length.is_null()) {
+                length = strtoull(content_length.str().c_str(), NULL, 10);
+            }
+            if (length > 0 && !accept_ranges.is_null() && accept_ranges.equals_nocase("bytes")) {
+                if (!Downloader::preallocate(fd, length)) {
+                    errstr_ = strerror(errno);
+                    ::close(fd);
+                    return false;
+                }
+                ranged_ = true;
+                ok = this->download_ranges(req, uri, Downloader::validator(res), fd, length);
             } else {
-#ifdef HAVE_SSL
-                nanosocket::Socket *p = new nanosocket::SSLSocket();
-                sock.reset(p);
-#else
-                errstr_ = "your binary donesn't supports SSL";
+                ok = this->download_stream(req, uri, fd);
+            }
+            if (::close(fd) != 0 && ok) {
+                errstr_ = strerror(errno);
+                return false;
+            }
+            return ok;
+        }
+    protected:
+        void setup(Client *client) {
+            client->set_timeout(timeout_);
+            client->set_keepalive(true);
+            client->set_dns_cache(dns_cache_);
+            if (proxy_url_) {
+                std::string proxy = proxy_url_.as_string();
+                client->set_proxy(proxy);
+            }
+        }
+        /// strong ETag, or Last-Modified for If-Range. empty if none.
+        static std::string validator(Response &res) {
+            StringRef etag = res.find_header("ETag");
+            if (!etag.is_null() && etag.str().compare(0, 2, "W/") != 0) {
+                return etag.str();
+            }
+            StringRef last_modified = res.find_header("Last-Modified");
+            return last_modified.is_null() ? std::string() : last_modified.str();
+        }
+        static bool preallocate(int fd, unsigned long long length) {
+            if (ftruncate(fd, length) != 0) {
                 return false;
+            }
+#ifdef __linux__
+            posix_fallocate(fd, 0, length); // best effort, to avoid fragmentation
 #endif
+            return true;
+        }
+        bool download_stream(Request &req, const std::string &uri, int fd) {
+            Client client;
+            this->setup(&client);
+            Request get("GET", uri.c_str());
+            *get.headers() = *req.headers();
+            get.set_header("Host", get.uri()->host().c_str());
+            Response res;
+            FileWriter writer(fd, 0, 0, false);
+            if (!client.send_request(get, &res, &writer)) {
+                errstr_ = writer.errstr().empty() ? client.errstr() : writer.errstr();
+                return false;
+            }
+            size_ = writer.written();
+            return true;
+        }
+        bool download_ranges(Request &req, const std::string &uri, const std::string &validator,
+                             int fd, unsigned long long length) {
+            Job job;
+            job.self      = this;
+            job.base      = &req;
+            job.uri       = uri;
+            job.validator = validator;
+            job.fd        = fd;
+            job.failed    = 0;
+            for (unsigned long long offset=0; offset<length; offset+=chunk_size_) {
+                Range r;
+                r.offset  = offset;
+                r.length  = std::min(chunk_size_, length - offset);
+                r.retries = 0;
+                job.queue.push_back(r);
+            }
+            size_t n = std::min((size_t)connections_, job.queue.size());
+            std::vector<pthread_t> threads;
+            for (size_t i=0; i<n; i++) {
+                pthread_t th;
+                if (pthread_create(&th, NULL, Downloader::worker_main, &job) != 0) {
+                    break;
+                }
+                threads.push_back(th);
+            }
+            if (threads.empty()) {
+                Downloader::worker_main(&job);
+            }
+            for (size_t i=0; i<threads.size(); i++) {
+                pthread_join(threads[i], NULL);
             }
+            if (job.failed) {
+                errstr_ = job.errstr;
+                return false;
+            }
+            size_ = length;
+            return true;
+        }
+        static void * worker_main(void *arg) {
+            Job *job = (Job *)arg;
+            Downloader *self = job->self;
+            Client client;
+            self->setup(&client);
+            while (1) {
+                Range r;
+                {
+                    ScopedLock lock(job->mutex);
+                    if (job->failed || job->queue.empty()) {
+                        return NULL;
+                    }
+                    r = job->queue.front();
+                    job->queue.pop_front();
+                }
 
-            if (!proxy_url_) {
-                short port =    req.uri()->port() == 0
-                            ? (req.uri()->scheme() == "https" ? 443 : 80)
-                            : req.uri()->port();
-                if (!sock->connect(req.uri()->host().c_str(), port)) {
-                    errstr_ = sock->errstr();
-                    return false;
+                Request get("GET", job->uri.c_str());
+                *get.headers() = *job->base->headers();
+                get.set_header("Host", get.uri()->host().c_str());
+                std::ostringstream range;
+                range << "bytes=" << r.offset << "-" << (r.offset + r.length - 1);
+                get.set_header("Range", range.str().c_str());
+                if (!job->validator.empty()) {
+                    get.set_header("If-Range", job->validator.c_str());
                 }
-            } else { // use proxy
-                if (!sock->connect(proxy_url_.host().c_str(), proxy_url_.port())) {
-                    errstr_ = sock->errstr();
-                    return false;
+                Response res;
+                FileWriter writer(job->fd, r.offset, r.length, true, &job->failed);
+                bool ok = client.send_request(get, &res, &writer) && writer.written() == r.length;
+                if (ok) {
+                    continue;
                 }
-            }
 
-            int opt = 1;
-            sock->setsockopt(IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(int));
+                ScopedLock lock(job->mutex);
+                if (job->failed) {
+                    return NULL;
+                }
+                if (r.retries >= self->max_retries_ || res.status() == 200) {
+                    // 200 won't be better on retry
+                    job->failed = 1;
+                    job->errstr = !writer.errstr().empty() ? writer.errstr()
+                                : !client.errstr().empty() ? client.errstr()
+                                : std::string("incomplete range");
+                    return NULL;
+                }
+                r.offset  += writer.written(); // resume
+                r.length  -= writer.written();
+                r.retries += 1;
+                self->retries_ += 1;
+                job->queue.push_back(r);
+            }
+        }
+    };
 
-            if (!req.write_header(*sock, this->is_proxy())) {
-                errstr_ = "error in writing header";
-                return false;
+#ifdef __linux__
+    /**
+     * runs many requests concurrently over non-blocking sockets with one
+     * event loop, in one thread.
+     *
+     *   nanowww::MultiClient multi;
+     *   for (...) { multi.add(req[i], &res[i]); }
+     *   multi.run();
+     *
+     * or call step() from your own event loop, waiting for fd() to be readable.
+     * the results are reported through ResponseHandler::on_complete()/on_error(),
+     * or by is_success(id)/errstr(id) after they finished.
+     * redirects are not followed.
+     *
+     * the event loop is epoll. if the binary is built with HAVE_LIBURING and
+     * the kernel supports it, io_uring is used instead: connect/send/recv of
+     * plain HTTP requests are submitted in batches, and responses are read
+     * into registered buffers. TLS requests use io_uring as the poller.
+     */
+    class MultiClient {
+    public:
+        enum Backend {
+            BACKEND_AUTO,   // io_uring if available, else epoll
+            BACKEND_EPOLL,
+            BACKEND_URING
+        };
+    private:
+        enum State {
+            STATE_PENDING,
+            STATE_CONNECTING,
+            STATE_HANDSHAKING,
+            STATE_SENDING,
+            STATE_READING_HEADER,
+            STATE_READING_BODY,
+            STATE_DONE
+        };
+        struct Transfer {
+            size_t id;
+            Request *req;
+            Response *res;
+            ResponseHandler *handler;
+            BufferingHandler buffering;
+            Connection *conn;
+            State state;
+            short events;        // events registered to epoll
+            std::string out;     // serialized request
+            size_t out_pos;
+            std::string in;      // received header part
+            size_t header_len;
+            BodyReader reader;
+            Deadline deadline;
+            bool success;
+            std::string errstr;
+            bool inflight;       // io_uring operation is submitted
+            int buf_index;       // registered buffer for io_uring reads
+            struct sockaddr_storage addr;
+            socklen_t addrlen;
+            std::list<Transfer*>::iterator active_pos; // in active_, while running
+            Transfer(Response *r) : buffering(r) { }
+        };
+        Backend backend_;
+        int epfd_;
+        std::vector<Transfer*> transfers_; // all of them, by id
+        std::list<Transfer*> pending_;
+        std::list<Transfer*> active_;      // running ones. step() looks only at them
+        size_t running_;
+        size_t max_concurrency_;
+        unsigned int timeout_;
+        DNSCache *dns_cache_;
+#ifdef HAVE_SSL
+        ScopedPtr<TLSContext> tls_;
+#endif
+        std::vector<char> read_buf_;
+#ifdef HAVE_LIBURING
+        struct io_uring ring_;
+        std::vector<char> uring_bufs_;
+        std::vector<int> free_bufs_;
+        size_t inflight_; // submitted operations not reaped yet
+#endif
+    public:
+        MultiClient(Backend backend=BACKEND_AUTO) {
+            running_ = 0;
+            max_concurrency_ = 0;
+            timeout_ = 60; // same as Client
+            dns_cache_ = NULL;
+            read_buf_.resize(NANOWWW_READ_BUFFER_SIZE);
+            epfd_ = -1;
+            backend_ = BACKEND_EPOLL;
+#ifdef HAVE_LIBURING
+            inflight_ = 0;
+            if (backend != BACKEND_EPOLL && this->init_uring()) {
+                backend_ = BACKEND_URING;
             }
-            if (!req.write_content(*sock)) {
-                errstr_ = "error in writing body";
-                return false;
+#else
+            (void)backend;
+#endif
+            if (backend_ == BACKEND_EPOLL) {
+                epfd_ = epoll_create(1024);
+                fcntl(epfd_, F_SETFD, FD_CLOEXEC);
+            }
+        }
+        ~MultiClient() {
+            this->clear();
+#ifdef HAVE_LIBURING
+            if (backend_ == BACKEND_URING) {
+                io_uring_queue_exit(&ring_);
+            }
+#endif
+            if (epfd_ != -1) {
+                ::close(epfd_);
+            }
+        }
+        /// the backend actually used
+        inline Backend backend() { return backend_; }
+        /// timeout of each request in sec. 0 means no timeout.
+        inline void set_timeout(unsigned int timeout) { timeout_ = timeout; }
+        inline unsigned int timeout() { return timeout_; }
+        /**
+         * max number of requests in flight. 0 means unlimited.
+         * io_uring backend is also limited by NANOWWW_URING_BUFFERS.
+         */
+        inline void set_max_concurrency(size_t n) { max_concurrency_ = n; }
+        inline size_t max_concurrency() { return max_concurrency_; }
+        /// same as Client::set_dns_cache(). name resolution blocks the loop, so caching it helps.
+        inline void set_dns_cache(DNSCache *cache) { dns_cache_ = cache; }
+#ifdef HAVE_SSL
+        /// same as Client::tls_context()
+        inline TLSContext * tls_context() {
+            if (!tls_.get()) {
+                tls_.reset(new TLSContext());
+            }
+            return tls_.get();
+        }
+#endif
+        /// fd to wait for. it becomes readable when step() has something to do.
+        inline int fd() {
+#ifdef HAVE_LIBURING
+            if (backend_ == BACKEND_URING) {
+                return ring_.ring_fd;
             }
+#endif
+            return epfd_;
+        }
+        /// number of requests not finished yet
+        inline size_t remaining() { return running_ + pending_.size(); }
 
-            // reading loop
-            std::string buf;
-            char read_buf[NANOWWW_READ_BUFFER_SIZE];
+        /**
+         * register the request. req, res and handler must be alive until it finishes.
+         * if handler is NULL, the body is stored in res.
+         * @return id of the request
+         */
+        size_t add(Request &req, Response *res, ResponseHandler *handler=NULL) {
+            Transfer *t   = new Transfer(res);
+            t->id         = transfers_.size();
+            t->req        = &req;
+            t->res        = res;
+            t->handler    = handler ? handler : &t->buffering;
+            t->conn       = NULL;
+            t->state      = STATE_PENDING;
+            t->events     = 0;
+            t->out_pos    = 0;
+            t->header_len = 0;
+            t->success    = false;
+            t->inflight   = false;
+            t->buf_index  = -1;
+            t->addrlen    = 0;
+            transfers_.push_back(t);
+            pending_.push_back(t);
+            return t->id;
+        }
+        inline bool is_done(size_t id) { return transfers_[id]->state == STATE_DONE; }
+        inline bool is_success(size_t id) { return transfers_[id]->success; }
+        inline const std::string & errstr(size_t id) { return transfers_[id]->errstr; }
 
-            // read header part
-            while (1) {
-                int nread = sock->recv(read_buf, sizeof(read_buf));
-                if (nread == 0) { // eof
-                    errstr_ = "EOF";
+        /**
+         * run until all requests finish.
+         * @return true if all requests succeeded
+         */
+        bool run() {
+            while (this->remaining() > 0) {
+                this->step(-1);
+            }
+            for (size_t i=0; i<transfers_.size(); i++) {
+                if (!transfers_[i]->success) {
                     return false;
                 }
-                if (nread < 0) { // error
-                    errstr_ = strerror(errno);
-                    return false;
+            }
+            return true;
+        }
+        /**
+         * start pending requests, and process the ready sockets.
+         * @args timeout_msec: max time to wait for I/O. -1 means until something happens.
+         * @return number of requests not finished yet
+         */
+        size_t step(int timeout_msec) {
+            this->start_pending();
+            if (running_ == 0) {
+#ifdef HAVE_LIBURING
+                // the buffers are held by cancelled operations. reap them.
+                if (backend_ == BACKEND_URING && !pending_.empty() && inflight_ > 0) {
+                    this->poll_uring(timeout_msec);
+                    this->start_pending();
                 }
-                buf.append(read_buf, nread);
+#endif
+                return this->remaining();
+            }
 
-                int minor_version;
-                int status;
-                const char *msg;
-                size_t msg_len;
-                struct phr_header headers[NANOWWW_MAX_HEADERS];
-                size_t num_headers = sizeof(headers) / sizeof(headers[0]);
-                int last_len = 0;
-                int ret = phr_parse_response(buf.c_str(), buf.size(), &minor_version, &status, &msg, &msg_len, headers, &num_headers, last_len);
-                if (ret > 0) {
-                    res->set_status(status);
-                    res->set_message(msg, msg_len);
-                    for (size_t i=0; i<num_headers; i++) {
-                        res->push_header(
-                            std::string(headers[i].name, headers[i].name_len),
-                            std::string(headers[i].value, headers[i].value_len)
-                        );
-                    }
-                    res->add_content(buf.substr(ret));
-                    break;
-                } else if (ret == -1) { // parse error
-                    errstr_ = "http response parse error";
-                    return false;
-                } else if (ret == -2) { // request is partial
+            // don't sleep over the nearest deadline
+            int wait = timeout_msec;
+            for (std::list<Transfer*>::iterator iter = active_.begin(); iter != active_.end(); ++iter) {
+                Transfer *t = *iter;
+                if (t->deadline.is_infinite()) {
                     continue;
                 }
+                int rest = t->deadline.remaining_msec();
+                if (wait < 0 || rest < wait) {
+                    wait = rest;
+                }
             }
 
-            if ((res->status() == 301 || res->status() == 302) && (req.method() == std::string("GET") || req.method() == std::string("POST"))) {
-                if (remain_redirect <= 0) {
-                    errstr_ = "Redirect loop detected";
-                    return false;
-                } else {
-                    req.set_uri(res->get_header("Location"));
-                    return this->send_request_internal(req, res, remain_redirect-1);
+#ifdef HAVE_LIBURING
+            if (backend_ == BACKEND_URING) {
+                this->poll_uring(wait);
+            } else
+#endif
+            {
+                struct epoll_event events[64];
+                int n = epoll_wait(epfd_, events, sizeof(events)/sizeof(events[0]), wait);
+                for (int i=0; i<n; i++) {
+                    this->on_ready((Transfer*)events[i].data.ptr);
                 }
             }
 
-            // read body part
-            while (1) {
-                int nread = sock->recv(read_buf, sizeof(read_buf));
-                if (nread == 0) { // eof
+            for (std::list<Transfer*>::iterator iter = active_.begin(); iter != active_.end(); ) {
+                Transfer *t = *iter++; // fail() removes it from active_
+                if (t->deadline.is_expired()) {
+                    errno = ETIMEDOUT;
+                    this->fail(t, strerror(errno));
+                }
+            }
+            this->start_pending();
+            return this->remaining();
+        }
+        /// forget all requests. running ones are aborted.
+        void clear() {
+            for (size_t i=0; i<transfers_.size(); i++) {
+                if (this->is_running(transfers_[i])) {
+                    this->fail(transfers_[i], "aborted");
+                }
+            }
+#ifdef HAVE_LIBURING
+            // wait for the cancellation of submitted operations
+            while (backend_ == BACKEND_URING && inflight_ > 0) {
+                this->poll_uring(-1);
+            }
+#endif
+            for (size_t i=0; i<transfers_.size(); i++) {
+                delete transfers_[i]->conn;
+                delete transfers_[i];
+            }
+            transfers_.clear();
+            pending_.clear();
+            active_.clear();
+            running_ = 0;
+        }
+    protected:
+        inline bool is_running(Transfer *t) {
+            return t->state != STATE_DONE && t->state != STATE_PENDING;
+        }
+        void start_pending() {
+            while (!pending_.empty() && (max_concurrency_ == 0 || running_ < max_concurrency_)) {
+#ifdef HAVE_LIBURING
+                if (backend_ == BACKEND_URING && free_bufs_.empty()) {
                     break;
-                } else if (nread < 0) { // error
-                    errstr_ = strerror(errno);
-                    return false;
-                } else {
-                    res->add_content(read_buf, nread);
-                    continue;
                 }
+#endif
+                Transfer *t = pending_.front();
+                pending_.pop_front();
+                running_++;
+                this->start(t);
+            }
+#ifdef HAVE_LIBURING
+            if (backend_ == BACKEND_URING) {
+                io_uring_submit(&ring_);
+            }
+#endif
+        }
+        void start(Transfer *t) {
+            t->state    = STATE_CONNECTING;
+            t->deadline = Deadline::after(timeout_);
+            t->active_pos = active_.insert(active_.end(), t);
+            nanouri::Uri *uri = t->req->uri();
+            if (uri->scheme() == "http") {
+                t->conn = new Connection();
+            } else {
+#ifdef HAVE_SSL
+                t->conn = new TLSConnection(this->tls_context());
+#else
+                this->fail(t, "your binary donesn't supports SSL");
+                return;
+#endif
             }
 
-            sock->close();
+            // serialize the request
+            t->req->serialize_header(&t->out, false);
+            BufferSocket bsock(&t->out);
+            if (!t->req->write_content(bsock)) {
+                this->fail(t, "error in writing request");
+                return;
+            }
+
+            short port = uri->port() == 0 ? (uri->scheme() == "https" ? 443 : 80) : uri->port();
+            std::vector<Address> addrs;
+            t->conn->set_dns_cache(dns_cache_);
+            if (!t->conn->resolve(uri->host().c_str(), port, &addrs)) {
+                this->fail(t, t->conn->errstr());
+                return;
+            }
+            memcpy(&t->addr, &addrs[0].addr, addrs[0].len);
+            t->addrlen = addrs[0].len;
+
+#ifdef HAVE_LIBURING
+            if (backend_ == BACKEND_URING) {
+                t->buf_index = free_bufs_.back();
+                free_bufs_.pop_back();
+                if (!t->conn->is_tls()) {
+                    this->uring_start_plain(t);
+                    return;
+                }
+            }
+#endif
+            int ret = t->conn->start_connect((struct sockaddr*)&t->addr, t->addrlen);
+            if (ret < 0) {
+                this->fail(t, t->conn->errstr());
+                return;
+            }
+            if (ret == 1) {
+                this->on_ready(t);
+            } else {
+                this->watch(t, POLLOUT);
+            }
+        }
+        /// drive the state machine as far as possible without blocking
+        void on_ready(Transfer *t) {
+            short events = 0;
+            if (t->state == STATE_CONNECTING) {
+                if (!t->conn->finish_connect()) {
+                    this->fail(t, t->conn->errstr());
+                    return;
+                }
+                if (!t->conn->start_handshake(t->req->uri()->host().c_str())) {
+                    this->fail(t, t->conn->errstr());
+                    return;
+                }
+                t->state = STATE_HANDSHAKING;
+            }
+            if (t->state == STATE_HANDSHAKING) {
+                int ret = t->conn->try_handshake(&events);
+                if (ret < 0) {
+                    this->fail(t, t->conn->errstr());
+                    return;
+                } else if (ret == 0) {
+                    this->watch(t, events);
+                    return;
+                }
+                t->state = STATE_SENDING;
+            }
+            if (t->state == STATE_SENDING) {
+                while (t->out_pos < t->out.size()) {
+                    ssize_t sent = t->conn->try_send(t->out.data() + t->out_pos, t->out.size() - t->out_pos, &events);
+                    if (sent < 0) {
+                        if (errno == EAGAIN) {
+                            this->watch(t, events);
+                        } else {
+                            this->fail(t, strerror(errno));
+                        }
+                        return;
+                    }
+                    t->out_pos += sent;
+                }
+                std::string().swap(t->out);
+                t->state = STATE_READING_HEADER;
+            }
+            while (this->is_running(t)) {
+                char *buf = &read_buf_[0];
+                size_t len = this->wanted(t, read_buf_.size());
+                ssize_t nread = t->conn->try_recv(buf, len, &events);
+                if (nread < 0) {
+                    if (errno == EAGAIN) {
+                        this->watch(t, events);
+                    } else {
+                        this->fail(t, strerror(errno));
+                    }
+                    return;
+                }
+                this->on_input(t, buf, nread);
+            }
+        }
+        inline size_t wanted(Transfer *t, size_t bufsize) {
+            return t->state == STATE_READING_BODY ? t->reader.wanted(bufsize) : bufsize;
+        }
+        /// process received bytes. nread == 0 means EOF.
+        void on_input(Transfer *t, const char *buf, size_t nread) {
+            if (t->state == STATE_READING_HEADER) {
+                if (nread == 0) {
+                    this->fail(t, "EOF");
+                    return;
+                }
+                size_t last_len = t->in.size();
+                t->in.append(buf, nread);
+                int minor_version;
+                int ret = t->res->parse_header(t->in.c_str(), t->in.size(), last_len, &minor_version);
+                if (ret == -1) {
+                    this->fail(t, "http response parse error");
+                    return;
+                } else if (ret == -2) {
+                    return;
+                }
+                if (!t->handler->on_header(*t->res)) {
+                    this->fail(t, "aborted by handler");
+                    return;
+                }
+                size_t content_length;
+                BodyReader::Mode mode = BodyReader::detect(t->req->method(), t->res, &content_length);
+                t->reader.init(mode, content_length);
+                if (mode == BodyReader::MODE_LENGTH) {
+                    t->handler->on_content_length(content_length);
+                }
+                t->state = STATE_READING_BODY;
+                if (!this->feed(t, t->in.c_str() + ret, t->in.size() - ret)) {
+                    return;
+                }
+                std::string().swap(t->in);
+            } else if (nread == 0) {
+                if (!t->reader.finish_on_eof()) {
+                    this->fail(t, "unexpected EOF while reading body");
+                    return;
+                }
+            } else if (!this->feed(t, buf, nread)) {
+                return;
+            }
+            if (t->reader.is_done()) {
+                this->finish(t);
+            }
+        }
+        bool feed(Transfer *t, const char *buf, size_t len) {
+            ssize_t consumed = t->reader.feed(buf, len, t->handler);
+            if (consumed < 0) {
+                this->fail(t, consumed == -1 ? "broken chunked encoding" : "aborted by handler");
+                return false;
+            }
             return true;
         }
-        inline int max_redirects() { return max_redirects_; }
-        inline void set_max_redirects(int mr) { max_redirects_ = mr; }
+        /// wait for the socket to be ready
+        void watch(Transfer *t, short events) {
+#ifdef HAVE_LIBURING
+            if (backend_ == BACKEND_URING) {
+                struct io_uring_sqe *sqe = this->get_sqe();
+                io_uring_prep_poll_add(sqe, t->conn->fd(), events);
+                this->submitted(sqe, t);
+                return;
+            }
+#endif
+            if (t->events == events) {
+                return;
+            }
+            struct epoll_event ev;
+            ev.events = 0;
+            if (events & POLLIN)  { ev.events |= EPOLLIN; }
+            if (events & POLLOUT) { ev.events |= EPOLLOUT; }
+            ev.data.ptr = t;
+            if (epoll_ctl(epfd_, t->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, t->conn->fd(), &ev) != 0) {
+                this->fail(t, strerror(errno));
+                return;
+            }
+            t->events = events;
+        }
+        void close(Transfer *t) {
+            if (t->conn) {
+                if (t->events) {
+                    epoll_ctl(epfd_, EPOLL_CTL_DEL, t->conn->fd(), NULL);
+                }
+#ifdef HAVE_LIBURING
+                if (t->inflight) {
+                    // the connection and the buffers are released when the
+                    // cancelled operation completes. see on_uring_complete().
+                    struct io_uring_sqe *sqe = this->get_sqe();
+                    io_uring_prep_cancel(sqe, t, 0);
+                    io_uring_sqe_set_data(sqe, NULL);
+                } else
+#endif
+                {
+                    delete t->conn;
+                    t->conn = NULL;
+                }
+            }
+#ifdef HAVE_LIBURING
+            if (!t->inflight) {
+                this->release_buffer(t);
+            }
+#endif
+            t->events = 0;
+            if (t->state != STATE_PENDING) {
+                running_--;
+                active_.erase(t->active_pos);
+            }
+            t->state = STATE_DONE;
+            if (!t->inflight) { // a cancelled send may still read out
+                // only the result is kept for is_success()/errstr()
+                std::string().swap(t->out);
+                std::string().swap(t->in);
+            }
+        }
+        void finish(Transfer *t) {
+            this->close(t);
+            t->success = true;
+            t->handler->on_complete(*t->res);
+        }
+        void fail(Transfer *t, const std::string &errstr) {
+            this->close(t);
+            t->errstr = errstr;
+            t->handler->on_error(errstr);
+        }
+#ifdef HAVE_LIBURING
+        bool init_uring() {
+            if (io_uring_queue_init(NANOWWW_URING_ENTRIES, &ring_, 0) != 0) {
+                return false;
+            }
+            uring_bufs_.resize((size_t)NANOWWW_URING_BUFFERS * NANOWWW_READ_BUFFER_SIZE);
+            std::vector<struct iovec> iov(NANOWWW_URING_BUFFERS);
+            for (int i=0; i<NANOWWW_URING_BUFFERS; i++) {
+                iov[i].iov_base = &uring_bufs_[(size_t)i * NANOWWW_READ_BUFFER_SIZE];
+                iov[i].iov_len  = NANOWWW_READ_BUFFER_SIZE;
+                free_bufs_.push_back(i);
+            }
+            if (io_uring_register_buffers(&ring_, &iov[0], iov.size()) != 0) {
+                io_uring_queue_exit(&ring_);
+                std::vector<char>().swap(uring_bufs_);
+                free_bufs_.clear();
+                return false;
+            }
+            return true;
+        }
+        struct io_uring_sqe * get_sqe() {
+            struct io_uring_sqe *sqe;
+            while ((sqe = io_uring_get_sqe(&ring_)) == NULL) {
+                io_uring_submit(&ring_); // submission queue is full. flush it.
+            }
+            return sqe;
+        }
+        inline void submitted(struct io_uring_sqe *sqe, Transfer *t) {
+            io_uring_sqe_set_data(sqe, t);
+            t->inflight = true;
+            ++inflight_;
+        }
+        /**
+         * give the registered buffer back. it must not be done while a read
+         * into it is in flight, even if it's cancelled: the read may still
+         * complete into the buffer of the next transfer.
+         */
+        void release_buffer(Transfer *t) {
+            if (t->buf_index >= 0) {
+                free_bufs_.push_back(t->buf_index);
+                t->buf_index = -1;
+            }
+        }
+        /// plain HTTP: connect, send and read are io_uring operations
+        void uring_start_plain(Transfer *t) {
+            int fd = ::socket(t->addr.ss_family, SOCK_STREAM, 0);
+            if (fd == -1 || !t->conn->adopt(fd)) {
+                this->fail(t, strerror(errno));
+                return;
+            }
+            struct io_uring_sqe *sqe = this->get_sqe();
+            io_uring_prep_connect(sqe, fd, (struct sockaddr*)&t->addr, t->addrlen);
+            this->submitted(sqe, t);
+        }
+        void uring_send(Transfer *t) {
+            struct io_uring_sqe *sqe = this->get_sqe();
+            io_uring_prep_send(sqe, t->conn->fd(), t->out.data() + t->out_pos, t->out.size() - t->out_pos, MSG_NOSIGNAL);
+            this->submitted(sqe, t);
+        }
+        void uring_read(Transfer *t) {
+            struct io_uring_sqe *sqe = this->get_sqe();
+            char *buf = &uring_bufs_[(size_t)t->buf_index * NANOWWW_READ_BUFFER_SIZE];
+            io_uring_prep_read_fixed(sqe, t->conn->fd(), buf, this->wanted(t, NANOWWW_READ_BUFFER_SIZE), 0, t->buf_index);
+            this->submitted(sqe, t);
+        }
+        void on_uring_complete(Transfer *t, int res) {
+            t->inflight = false;
+            --inflight_;
+            if (t->state == STATE_DONE) { // cancelled, or finished before the cancel
+                delete t->conn;
+                t->conn = NULL;
+                this->release_buffer(t);
+                std::string().swap(t->out);
+                std::string().swap(t->in);
+                return;
+            }
+            if (t->conn->is_tls() || t->state == STATE_HANDSHAKING) {
+                this->on_ready(t); // completion of poll
+                return;
+            }
+            if (res < 0) {
+                this->fail(t, strerror(-res));
+                return;
+            }
+            if (t->state == STATE_CONNECTING) {
+                t->state = STATE_SENDING;
+                this->uring_send(t);
+            } else if (t->state == STATE_SENDING) {
+                t->out_pos += res;
+                if (t->out_pos < t->out.size()) {
+                    this->uring_send(t);
+                    return;
+                }
+                std::string().swap(t->out);
+                t->state = STATE_READING_HEADER;
+                this->uring_read(t);
+            } else {
+                char *buf = &uring_bufs_[(size_t)t->buf_index * NANOWWW_READ_BUFFER_SIZE];
+                this->on_input(t, buf, res);
+                if (this->is_running(t)) {
+                    this->uring_read(t);
+                }
+            }
+        }
+        void poll_uring(int timeout_msec) {
+            io_uring_submit(&ring_);
+            struct io_uring_cqe *cqe;
+            struct __kernel_timespec ts;
+            ts.tv_sec  = timeout_msec / 1000;
+            ts.tv_nsec = (timeout_msec % 1000) * 1000000L;
+            int ret = io_uring_wait_cqe_timeout(&ring_, &cqe, timeout_msec < 0 ? NULL : &ts);
+            while (ret == 0) {
+                Transfer *t = (Transfer*)io_uring_cqe_get_data(cqe);
+                int res = cqe->res;
+                io_uring_cqe_seen(&ring_, cqe);
+                if (t) { // NULL is the cancel request itself
+                    this->on_uring_complete(t, res);
+                }
+                ret = io_uring_peek_cqe(&ring_, &cqe);
+            }
+            io_uring_submit(&ring_);
+        }
+#endif
     };
+#endif
 };
 
 #endif  // NANOWWW_H_
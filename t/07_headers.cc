@@ -17,6 +17,50 @@ int main() {
         "C: 5\r\n"
     );
 
+    // field names are case-insensitive
+    is(headers.get_header("a"), std::string("1"));
+    is(headers.find_header("c").str(), std::string("5"));
+    ok(headers.find_header("b").is_null(), "removed");
+
+    {
+        // set_header keeps the position of the field
+        nanowww::Headers h;
+        h.push_header("Host", "example.com");
+        h.push_header("X-Foo", "1");
+        h.push_header("User-Agent", "x");
+        h.push_header("x-foo", "2");
+        h.set_header("X-FOO", "3");
+        is(h.as_string(),
+            "Host: example.com\r\n"
+            "X-Foo: 3\r\n"
+            "User-Agent: x\r\n"
+        );
+        is(h.size(), (size_t)3);
+        is(h.name(2).str(), std::string("User-Agent"));
+        is(h.value(2).str(), std::string("x"));
+    }
+
+    {
+        // many updates are compacted
+        nanowww::Headers h;
+        h.push_header("A", "a");
+        for (int i=0; i<10000; i++) {
+            h.set_header("B", std::string(100, 'b'));
+        }
+        is(h.as_string(), std::string("A: a\r\nB: ") + std::string(100, 'b') + "\r\n");
+    }
+
+    {
+        // Content-Length over 4GB is not truncated
+        nanowww::CallbackBodySource source(NULL, NULL, 5ULL * 1024 * 1024 * 1024);
+        nanowww::Request req("PUT", "http://example.com/upload");
+        req.set_body(&source);
+        std::string buf;
+        req.serialize_header(&buf, false);
+        is(req.get_header("Content-Length"), std::string("5368709120"));
+        ok(buf.find("\r\nContent-Length: 5368709120\r\n") != std::string::npos, "in the header");
+    }
+
     done_testing();
 }
 
@@ -15,6 +15,88 @@ int main() {
         is(req.get_header("User-Agent"), std::string("bar"));
     }
 
+    {
+        nanowww::Headers hdr;
+        hdr.set_header("X-Foo", "bar");
+        ok(!hdr.find_header("X-Foo").is_null(), "find_header");
+        is(hdr.find_header("X-Foo").str(), std::string("bar"));
+        ok(hdr.find_header("X-None").is_null(), "find_header: not found");
+        is(hdr.get_header("X-None"), std::string(""), "get_header: not found");
+    }
+
+    {
+        nanowww::Response res;
+        res.add_content(std::string(1024, 'x'));
+        const char *p = res.content().c_str();
+        std::string body;
+        res.take_content(&body);
+        is(body, std::string(1024, 'x'), "take_content");
+        ok(body.c_str() == p, "take_content: not copied");
+        ok(res.content().empty(), "take_content: moved out");
+    }
+
+    {
+        size_t n = 0;
+        ok(nanowww::StringRef("123", 3).to_size(&n), "to_size");
+        is(n, (size_t)123);
+        ok(!nanowww::StringRef("12a", 3).to_size(&n), "to_size: not a number");
+        ok(!nanowww::StringRef().to_size(&n), "to_size: null");
+    }
+
+    {
+        const char *raw =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/plain\r\n"
+            "X-Multi: 1\r\n"
+            "X-Multi: 2\r\n"
+            "\r\n"
+            "body";
+        nanowww::Response res;
+        for (int i=0; i<3; i++) {
+            res.reset();
+            int minor_version;
+            int ret = res.parse_header(raw, strlen(raw), 0, &minor_version);
+            is(ret, (int)(strlen(raw) - 4), "parse_header");
+            is(res.status(), 200);
+            is(res.message(), std::string("OK"));
+            is(res.get_header("content-type"), std::string("text/plain"));
+            is(res.headers()->size(), (size_t)3);
+            ok(res.content().empty(), "reset clears content");
+            res.add_content("body", 4);
+        }
+        int minor_version;
+        is(res.parse_header(raw, 20, 0, &minor_version), -2, "parse_header: partial");
+    }
+
+    {
+        nanowww::Request req("POST", "http://example.com/foo?bar=baz", "a=b");
+        std::string hbuf;
+        req.serialize_header(&hbuf, false);
+        is(hbuf.substr(0, hbuf.find("\r\n")), std::string("POST /foo?bar=baz HTTP/1.0"), "serialize_header");
+        ok(hbuf.find("Content-Length: 3\r\n") != std::string::npos, "serialize_header: content-length");
+        is(hbuf.substr(hbuf.size()-4), std::string("\r\n\r\n"));
+
+        std::string out;
+        nanowww::BufferSocket bsock(&out);
+        std::string wbuf;
+        ok(req.write_request(bsock, false, &wbuf), "write_request");
+        is(out, hbuf + "a=b", "write_request: header and content");
+    }
+
+    {
+        nanouri::Uri base;
+        base.parse("http://example.com:8080/a/b/c?q=1");
+        is(nanowww::resolve_uri(base, "https://example.org/x"), std::string("https://example.org/x"), "resolve_uri: absolute");
+        is(nanowww::resolve_uri(base, "//example.org/x"), std::string("http://example.org/x"), "resolve_uri: network-path");
+        is(nanowww::resolve_uri(base, "/x?y=2"), std::string("http://example.com:8080/x?y=2"), "resolve_uri: absolute-path");
+        is(nanowww::resolve_uri(base, "d"), std::string("http://example.com:8080/a/b/d"), "resolve_uri: relative");
+        is(nanowww::resolve_uri(base, "../d/./e"), std::string("http://example.com:8080/a/d/e"), "resolve_uri: dot segments");
+        is(nanowww::resolve_uri(base, "../../../../d"), std::string("http://example.com:8080/d"), "resolve_uri: above root");
+        is(nanowww::resolve_uri(base, "?z=3"), std::string("http://example.com:8080/a/b/c?z=3"), "resolve_uri: query");
+        is(nanowww::resolve_uri(base, "d#frag"), std::string("http://example.com:8080/a/b/d"), "resolve_uri: fragment");
+        is(nanowww::resolve_uri(base, ".."), std::string("http://example.com:8080/a/"), "resolve_uri: trailing dot segment");
+    }
+
     done_testing();
 }
 
@@ -0,0 +1,40 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::Client client;
+    client.set_timeout(3);
+    client.set_keepalive(true);
+    for (int i=0; i<3; i++) {
+        nanowww::Response res;
+        bool ret = client.send_get(&res, uri.c_str());
+        if (!client.errstr().empty()) {
+            diag(client.errstr().c_str());
+        }
+        assert(ret);
+        printf("%s\n", res.content().c_str());
+    }
+
+    // the server closes the connection at /drop without the response.
+    // GET is sent again on a new connection, POST is not.
+    {
+        nanowww::Response res;
+        printf("get=%d\n", client.send_get(&res, (uri + "drop").c_str()) ? 1 : 0);
+    }
+    {
+        nanowww::Response res;
+        assert(client.send_get(&res, uri.c_str())); // to reuse it
+        nanowww::Request req("POST", (uri + "drop").c_str(), "a=b");
+        printf("post=%d %s\n", client.send_request(req, &res) ? 1 : 0, client.errstr().c_str());
+    }
+    {
+        nanowww::Response res;
+        assert(client.send_get(&res, (uri + "count").c_str()));
+        printf("dropped=%s\n", res.content().c_str());
+    }
+    return 0;
+}
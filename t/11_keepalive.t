@@ -0,0 +1,47 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/11_keepalive $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my @lines = split /\n/, $res;
+        my @resend = splice @lines, 3;
+        is scalar(@lines), 3, 'three responses';
+        is scalar(keys %{{ map { $_ => 1 } @lines }}), 1, 'all requests used one connection';
+        is_deeply \@resend, [
+            'get=0',        # sent twice: reused, and new connection
+            'post=0 EOF',   # sent once
+            'dropped=3',
+        ];
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my $dropped = 0;
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            while ( my $r = $c->get_request ) {
+                if ($r->uri->path eq '/drop') {
+                    $dropped++;
+                    last;
+                } elsif ($r->uri->path eq '/count') {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], $dropped));
+                } else {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], $c->peerport));
+                }
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
@@ -0,0 +1,84 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+
+int main() {
+    const char *chunked =
+        "6;ext=1\r\n"
+        "hello \r\n"
+        "5\r\n"
+        "world\r\n"
+        "0\r\n"
+        "X-Trailer: 1\r\n"
+        "\r\n"
+        "garbage";
+
+    {
+        nanowww::Response res;
+        nanowww::BodyReader reader;
+        reader.init(nanowww::BodyReader::MODE_CHUNKED);
+        ssize_t consumed = reader.feed(chunked, strlen(chunked), &res);
+        ok(reader.is_done(), "chunked: done");
+        is(consumed, (ssize_t)(strlen(chunked) - strlen("garbage")), "chunked: trailing bytes are not consumed");
+        is(res.content(), std::string("hello world"), "chunked: content");
+    }
+
+    {
+        // feed byte by byte
+        nanowww::Response res;
+        nanowww::BodyReader reader;
+        reader.init(nanowww::BodyReader::MODE_CHUNKED);
+        const char *p = chunked;
+        while (!reader.is_done()) {
+            assert(reader.feed(p++, 1, &res) >= 0);
+        }
+        is(res.content(), std::string("hello world"), "chunked: content(byte by byte)");
+    }
+
+    {
+        nanowww::Response res;
+        nanowww::BodyReader reader;
+        reader.init(nanowww::BodyReader::MODE_CHUNKED);
+        is(reader.feed("zz\r\n", 4, &res), (ssize_t)-1, "chunked: broken size");
+    }
+
+    {
+        nanowww::Response res;
+        nanowww::BodyReader reader;
+        reader.init(nanowww::BodyReader::MODE_LENGTH, 3);
+        is(reader.wanted(100), (size_t)3, "length: wanted");
+        is(reader.feed("abcdef", 6, &res), (ssize_t)3, "length: consumed");
+        ok(reader.is_done(), "length: done");
+        ok(reader.finish_on_eof(), "length: eof after body is ok");
+        is(res.content(), std::string("abc"), "length: content");
+    }
+
+    {
+        nanowww::Response res;
+        nanowww::BodyReader reader;
+        reader.init(nanowww::BodyReader::MODE_LENGTH, 3);
+        reader.feed("a", 1, &res);
+        ok(!reader.finish_on_eof(), "length: truncated body");
+    }
+
+    {
+        nanowww::Response res;
+        res.set_status(204);
+        res.push_header("Content-Length", "10");
+        size_t len;
+        is(nanowww::BodyReader::detect("GET", &res, &len), nanowww::BodyReader::MODE_NONE, "detect: 204");
+    }
+
+    {
+        nanowww::Response res;
+        res.set_status(200);
+        res.push_header("Content-Length", "10");
+        size_t len;
+        is(nanowww::BodyReader::detect("HEAD", &res, &len), nanowww::BodyReader::MODE_NONE, "detect: HEAD");
+        is(nanowww::BodyReader::detect("GET", &res, &len), nanowww::BodyReader::MODE_LENGTH, "detect: Content-Length");
+        is(len, (size_t)10, "detect: length");
+        res.push_header("Transfer-Encoding", "chunked");
+        is(nanowww::BodyReader::detect("GET", &res, &len), nanowww::BodyReader::MODE_CHUNKED, "detect: chunked wins");
+    }
+
+    done_testing();
+}
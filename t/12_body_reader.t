@@ -0,0 +1 @@
+exec q{t/12_body_reader} or die
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+class CountingHandler : public nanowww::ResponseHandler {
+public:
+    int status;
+    size_t length;
+    size_t bytes;
+    int chunks;
+    bool completed;
+    CountingHandler() : status(-1), length(0), bytes(0), chunks(0), completed(false) { }
+    bool on_header(nanowww::Response &res) {
+        status = res.status();
+        return true;
+    }
+    void on_content_length(size_t len) {
+        length = len;
+    }
+    bool on_body(const char *buf, size_t len) {
+        for (size_t i=0; i<len; i++) {
+            assert(buf[i] == 'x');
+        }
+        bytes += len;
+        chunks++;
+        return true;
+    }
+    void on_complete(nanowww::Response &res) {
+        (void)res;
+        completed = true;
+    }
+};
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::Client client;
+    client.set_timeout(3);
+
+    nanowww::Request req("GET", uri.c_str());
+    nanowww::Response res;
+    CountingHandler handler;
+    bool ret = client.send_request(req, &res, &handler);
+    if (!client.errstr().empty()) {
+        diag(client.errstr().c_str());
+    }
+    assert(ret);
+    assert(res.content().empty());
+    printf("status=%d length=%lu bytes=%lu completed=%d chunked=%d\n",
+        handler.status,
+        (unsigned long)handler.length,
+        (unsigned long)handler.bytes,
+        handler.completed ? 1 : 0,
+        handler.chunks > 1 ? 1 : 0);
+    return 0;
+}
@@ -0,0 +1,31 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/13_streaming $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        is $res, "status=200 length=1000000 bytes=1000000 completed=1 chunked=1\n";
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            while ( my $r = $c->get_request ) {
+                $c->send_response(HTTP::Response->new(200, 'ok', [], 'x' x 1000000));
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
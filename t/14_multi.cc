@@ -0,0 +1,59 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+class CountingHandler : public nanowww::ResponseHandler {
+public:
+    size_t bytes;
+    int completed;
+    CountingHandler() : bytes(0), completed(0) { }
+    bool on_body(const char *buf, size_t len) {
+        (void)buf;
+        bytes += len;
+        return true;
+    }
+    void on_complete(nanowww::Response &res) {
+        (void)res;
+        completed++;
+    }
+};
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    const int N = 10;
+    std::vector<nanowww::Request*> reqs;
+    std::vector<nanowww::Response> res(N+1);
+
+    nanowww::MultiClient multi;
+    multi.set_timeout(5);
+    multi.set_max_concurrency(4);
+    for (int i=0; i<N; i++) {
+        char path[32];
+        sprintf(path, "%d", i);
+        reqs.push_back(new nanowww::Request("GET", (uri + path).c_str()));
+        multi.add(*reqs.back(), &res[i]);
+    }
+    CountingHandler handler;
+    reqs.push_back(new nanowww::Request("GET", (uri + "big").c_str()));
+    size_t big = multi.add(*reqs.back(), &res[N], &handler);
+
+    bool ret = multi.run();
+    if (!ret) {
+        for (int i=0; i<=N; i++) {
+            if (!multi.is_success(i)) {
+                diag(multi.errstr(i).c_str());
+            }
+        }
+    }
+    assert(ret);
+    for (int i=0; i<N; i++) {
+        printf("%s\n", res[i].content().c_str());
+        delete reqs[i];
+    }
+    printf("big=%lu completed=%d\n", (unsigned long)handler.bytes, handler.completed);
+    assert(multi.is_done(big));
+    delete reqs[N];
+    return 0;
+}
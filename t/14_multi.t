@@ -0,0 +1,38 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+plan skip_all => 'MultiClient is only on Linux' unless -x 't/14_multi';
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/14_multi $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        is $res, join("", map { "YAY$_\n" } 0..9) . "big=1000000 completed=1\n";
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port, Listen => 20) || die;
+        while ( my $c = $d->accept ) {
+            while ( my $r = $c->get_request ) {
+                my ($path) = $r->uri->path =~ m{^/(.*)};
+                if ($path eq 'big') {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], 'x' x 1000000));
+                } else {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], "YAY$path"));
+                }
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
@@ -0,0 +1,47 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    std::string expected;
+    for (int i=0; i<100000; i++) {
+        expected += "nanowww ";
+    }
+
+    nanowww::Client client;
+    client.set_timeout(3);
+    ok(client.set_decode_content(true), "set_decode_content");
+
+    const char *paths[] = {"gzip", "deflate", "rawdeflate", "chunked"};
+    for (size_t i=0; i<sizeof(paths)/sizeof(paths[0]); i++) {
+        nanowww::Request req("GET", (uri + paths[i]).c_str());
+        nanowww::Response res;
+        bool ret = client.send_request(req, &res);
+        if (!ret) { diag(client.errstr().c_str()); }
+        ok(ret, paths[i]);
+        ok(res.content() == expected, "decoded");
+    }
+
+    {
+        nanowww::Response res;
+        ok(client.send_get(&res, uri + "accept"), "plain");
+        is(res.content(), std::string("gzip, deflate"), "Accept-Encoding");
+    }
+
+    {
+        nanowww::Response res;
+        ok(!client.send_get(&res, uri + "truncated"), "truncated");
+        is(client.errstr(), std::string("unexpected end of compressed body"));
+    }
+
+    {
+        nanowww::Response res;
+        ok(!client.send_get(&res, uri + "broken"), "broken");
+        diag(client.errstr().c_str());
+    }
+
+    done_testing();
+}
@@ -0,0 +1,56 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+use IO::Compress::Gzip qw/gzip/;
+use IO::Compress::Deflate qw/deflate/;
+use IO::Compress::RawDeflate qw/rawdeflate/;
+
+plan skip_all => 'zlib is not available' unless -x 't/15_gzip';
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/15_gzip $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        unlike $res, qr/^not ok/m, 'all ok';
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my $body = 'nanowww ' x 100000;
+        my %encoded;
+        gzip \$body => \$encoded{gzip};
+        deflate \$body => \$encoded{deflate};
+        rawdeflate \$body => \$encoded{rawdeflate};
+
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            while ( my $r = $c->get_request ) {
+                my $path = substr($r->uri->path, 1);
+                if ($path eq 'accept') {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], $r->header('Accept-Encoding')));
+                } elsif ($path eq 'chunked') {
+                    # HTTP::Daemon sends code ref content as chunked
+                    my @parts = unpack '(a100)*', $encoded{gzip};
+                    $c->send_response(HTTP::Response->new(200, 'ok', ['Content-Encoding' => 'gzip'], sub { shift @parts }));
+                } elsif ($path eq 'truncated') {
+                    $c->send_response(HTTP::Response->new(200, 'ok', ['Content-Encoding' => 'gzip'], substr($encoded{gzip}, 0, 100)));
+                } elsif ($path eq 'broken') {
+                    $c->send_response(HTTP::Response->new(200, 'ok', ['Content-Encoding' => 'gzip'], 'not compressed'));
+                } else {
+                    my $encoding = $path eq 'gzip' ? 'gzip' : 'deflate';
+                    $c->send_response(HTTP::Response->new(200, 'ok', ['Content-Encoding' => $encoding], $encoded{$path}));
+                }
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
@@ -0,0 +1,46 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+static void send(nanowww::Client &client, nanowww::Request &req) {
+    nanowww::Response res;
+    bool ret = client.send_request(req, &res);
+    if (!client.errstr().empty()) {
+        diag(client.errstr().c_str());
+    }
+    assert(ret);
+    printf("%d %s\n", (int)res.hops().size(), res.content().c_str());
+}
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::Client client;
+    client.set_timeout(3);
+    client.set_keepalive(true);
+
+    nanowww::Request get("GET", (uri + "a").c_str());
+    send(client, get);
+    nanowww::Request post307("POST", (uri + "307").c_str(), "foo");
+    send(client, post307);
+    nanowww::Request post303("POST", (uri + "303").c_str(), "foo");
+    send(client, post303);
+    nanowww::Request post302("POST", (uri + "302").c_str(), "foo");
+    send(client, post302);
+    nanowww::Request put308("PUT", (uri + "308").c_str(), "foo");
+    send(client, put308);
+    printf("restored=%d\n", put308.uri()->as_string() == uri + "308" ? 1 : 0);
+
+    nanowww::Request host("GET", (uri + "308host").c_str());
+    send(client, host);
+    nanowww::Request same("GET", (uri + "same").c_str());
+    same.set_header("Authorization", "Basic Zm9vOmJhcg==");
+    same.set_header("Cookie", "a=b");
+    send(client, same);
+    nanowww::Request other("GET", (uri + "other").c_str());
+    other.set_header("Authorization", "Basic Zm9vOmJhcg==");
+    other.set_header("Cookie", "a=b");
+    send(client, other);
+    return 0;
+}
@@ -0,0 +1,79 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/16_redirect $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my @lines = split /\n/, $res;
+        my @others = splice @lines, 5;
+        my %peers = map { (split / /, $_)[3] => 1 } @lines;
+        s/ \d+ / / for @lines, @others; # peerport
+        is_deeply \@lines, [
+            '3 GET /c ',
+            '2 POST /echo foo',
+            '2 GET /echo ',
+            '2 GET /echo ',
+            '2 PUT /echo foo',
+        ];
+        is scalar(keys %peers), 1, 'all requests used one connection';
+        is_deeply \@others, [
+            'restored=1',
+            "2 GET /host 127.0.0.1:$port",
+            '2 GET /creds auth=1 cookie=1',
+            '2 GET /creds auth=0 cookie=0', # other host
+        ];
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my %location = (
+            '/a'   => 'b?x=1', # relative
+            '/b'   => '../c',
+            '/302' => '/echo',
+            '/303' => '/echo',
+            '/307' => '/echo',
+            '/308' => "http://127.0.0.1:$port/echo",
+            '/308host' => "http://127.0.0.1:$port/host",
+            '/same'    => '/creds',
+            '/other'   => "http://localhost:$port/creds",
+        );
+        $SIG{CHLD} = 'IGNORE';
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            # the redirect to localhost comes on another connection
+            if (fork() == 0) {
+                while ( my $r = $c->get_request ) {
+                    my $path = $r->uri->path;
+                    if (my $loc = $location{$path}) {
+                        my $code = $path =~ /^\/(\d+)/ ? $1 : 302;
+                        $code = 301 if $path eq '/b';
+                        $c->send_response(HTTP::Response->new($code, 'moved', ['Location' => $loc], 'moved'));
+                    } else {
+                        my $content = $r->content;
+                        if ($path eq '/host') {
+                            $content = $r->header('Host');
+                        } elsif ($path eq '/creds') {
+                            $content = sprintf 'auth=%d cookie=%d',
+                                defined $r->header('Authorization') ? 1 : 0, defined $r->header('Cookie') ? 1 : 0;
+                        }
+                        $c->send_response(HTTP::Response->new(200, 'ok', [], join(' ', $r->method, $path, $c->peerport, $content)));
+                    }
+                }
+                $c->close;
+                exit 0;
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
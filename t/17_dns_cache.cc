@@ -0,0 +1,136 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include <arpa/inet.h>
+
+// stand-in resolver: "*.good" resolves to 192.0.2.1, others fail.
+class FakeDNSCache : public nanowww::DNSCache {
+public:
+    nanowww::Mutex mutex;
+    int lookups;
+    FakeDNSCache() : lookups(0) { }
+    ~FakeDNSCache() { this->stop_prefetch_thread(); }
+    int count() {
+        nanowww::ScopedLock lock(mutex);
+        return lookups;
+    }
+protected:
+    int lookup(const std::string &host, std::vector<nanowww::Address> *addrs) {
+        {
+            nanowww::ScopedLock lock(mutex);
+            ++lookups;
+        }
+        if (host.size() < 5 || host.substr(host.size() - 5) != ".good") {
+            return EAI_NONAME;
+        }
+        return nanowww::lookup_host("192.0.2.1", addrs, AI_NUMERICHOST);
+    }
+};
+
+static std::string to_s(const nanowww::Address &a) {
+    char buf[INET6_ADDRSTRLEN];
+    unsigned short port;
+    if (a.family() == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)a.sockaddr();
+        inet_ntop(AF_INET, &sin->sin_addr, buf, sizeof(buf));
+        port = ntohs(sin->sin_port);
+    } else {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)a.sockaddr();
+        inet_ntop(AF_INET6, &sin6->sin6_addr, buf, sizeof(buf));
+        port = ntohs(sin6->sin6_port);
+    }
+    std::ostringstream os;
+    os << buf << ":" << port;
+    return os.str();
+}
+
+int main() {
+    {
+        FakeDNSCache cache;
+        std::vector<nanowww::Address> addrs;
+        std::string errstr;
+        ok(cache.resolve("www.good", 80, &addrs, &errstr), "resolve");
+        is(addrs.size(), (size_t)1);
+        is(to_s(addrs[0]), std::string("192.0.2.1:80"));
+        ok(cache.resolve("www.good", 8080, &addrs, &errstr), "resolve: cached");
+        is(to_s(addrs[0]), std::string("192.0.2.1:8080"), "port is applied per call");
+        is(cache.count(), 1, "looked up once");
+
+        ok(!cache.resolve("www.bad", 80, &addrs, &errstr), "failure");
+        is(errstr, std::string(gai_strerror(EAI_NONAME)));
+        ok(!cache.resolve("www.bad", 80, &addrs, &errstr), "failure: cached");
+        is(addrs.size(), (size_t)0, "failure: the addresses of www.good are not cached");
+        is(cache.count(), 2, "negative caching");
+
+        nanowww::DNSCache::Stats stats = cache.stats();
+        is(stats.hits, 2UL, "hits");
+        is(stats.misses, 2UL, "misses");
+        is(stats.negative_hits, 1UL, "negative hits");
+    }
+
+    {
+        FakeDNSCache cache;
+        cache.set_ttl(0.1);
+        cache.set_negative_ttl(0);
+        std::vector<nanowww::Address> addrs;
+        std::string errstr;
+        cache.resolve("www.good", 80, &addrs, &errstr);
+        usleep(150 * 1000);
+        cache.resolve("www.good", 80, &addrs, &errstr);
+        is(cache.count(), 2, "expired");
+        cache.resolve("www.bad", 80, &addrs, &errstr);
+        cache.resolve("www.bad", 80, &addrs, &errstr);
+        is(cache.count(), 4, "negative caching disabled");
+        is(cache.size(), (size_t)1);
+    }
+
+    {
+        FakeDNSCache cache;
+        cache.set_ttl(0.4);
+        cache.set_prefetch(true);
+        std::vector<nanowww::Address> addrs;
+        std::string errstr;
+        cache.resolve("www.good", 80, &addrs, &errstr);
+        usleep(350 * 1000);
+        ok(cache.resolve("www.good", 80, &addrs, &errstr), "prefetch: served from cache");
+        for (int i=0; i<100 && cache.count() < 2; i++) {
+            usleep(10 * 1000);
+        }
+        is(cache.count(), 2, "prefetch: refreshed in background");
+        usleep(100 * 1000); // the old entry would have expired by now
+        ok(cache.resolve("www.good", 80, &addrs, &errstr), "prefetch: hit");
+        is(cache.count(), 2, "prefetch: no more lookup");
+        is(cache.stats().prefetches, 1UL, "prefetches");
+    }
+
+    {
+        FakeDNSCache cache;
+        ok(cache.load_hosts("t/dat/hosts"), "load_hosts");
+        ok(!cache.load_hosts("t/dat/no-such-file"), "load_hosts: missing file");
+        std::vector<nanowww::Address> addrs;
+        std::string errstr;
+        ok(cache.resolve("fixture.example", 443, &addrs, &errstr), "fixture");
+        is(addrs.size(), (size_t)2, "both families");
+        is(to_s(addrs[0]), std::string("127.0.0.1:443"));
+        is(to_s(addrs[1]), std::string("::1:443"));
+        ok(cache.resolve("alias.example", 80, &addrs, &errstr), "alias");
+        ok(cache.resolve("other.example", 80, &addrs, &errstr), "comment");
+        is(to_s(addrs[0]), std::string("10.0.0.1:80"));
+        ok(!cache.resolve("ignored.example", 80, &addrs, &errstr), "bogus line is ignored");
+        is(cache.count(), 1, "fixture entries are not looked up");
+        ok(cache.load_hosts("t/dat/hosts"), "load_hosts: reload");
+        ok(cache.resolve("fixture.example", 443, &addrs, &errstr), "reload");
+        is(addrs.size(), (size_t)2, "reload: replaced, not appended");
+    }
+
+    {
+        nanowww::DNSCache cache;
+        ok(cache.load_hosts("t/dat/hosts"), "load_hosts");
+        nanowww::Connection conn;
+        conn.set_dns_cache(&cache);
+        std::vector<nanowww::Address> addrs;
+        ok(conn.resolve("other.example", 80, &addrs), "Connection::resolve");
+        is(to_s(addrs[0]), std::string("10.0.0.1:80"));
+    }
+
+    done_testing();
+}
@@ -0,0 +1 @@
+exec q{t/17_dns_cache} or die
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include <arpa/inet.h>
+
+static nanowww::Address make_addr(const char *host, unsigned short port) {
+    std::vector<nanowww::Address> addrs;
+    int err = nanowww::lookup_host(host, &addrs, AI_NUMERICHOST);
+    assert(err == 0);
+    addrs[0].set_port(port);
+    return addrs[0];
+}
+
+static unsigned short port_of(const nanowww::Address &a) {
+    return ntohs(((const struct sockaddr_in *)a.sockaddr())->sin_port);
+}
+
+static int listen_on(int backlog, unsigned short *port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sin);
+    int ret = bind(fd, (struct sockaddr *)&sin, len);
+    assert(ret == 0);
+    getsockname(fd, (struct sockaddr *)&sin, &len);
+    *port = ntohs(sin.sin_port);
+    if (backlog >= 0) {
+        listen(fd, backlog);
+    }
+    return fd;
+}
+
+// a listener whose queue is full. SYNs to it are dropped, like a black-holed address.
+static int black_hole(unsigned short *port, std::vector<int> *fillers) {
+    int fd = listen_on(0, port);
+    nanowww::Address addr = make_addr("127.0.0.1", *port);
+    for (int i=0; i<3; i++) {
+        int c = socket(AF_INET, SOCK_STREAM, 0);
+        fcntl(c, F_SETFL, O_NONBLOCK);
+        connect(c, addr.sockaddr(), addr.len);
+        fillers->push_back(c);
+    }
+    usleep(100 * 1000);
+    return fd;
+}
+
+int main() {
+    {
+        std::vector<nanowww::Address> addrs;
+        addrs.push_back(make_addr("::1", 80));
+        addrs.push_back(make_addr("::2", 80));
+        addrs.push_back(make_addr("127.0.0.1", 80));
+        addrs.push_back(make_addr("127.0.0.2", 80));
+        nanowww::Connection conn;
+        conn.sort_addresses(&addrs);
+        ok(addrs[0].same_host(make_addr("::1", 0)), "sort: interleaved");
+        ok(addrs[1].same_host(make_addr("127.0.0.1", 0)));
+        ok(addrs[2].same_host(make_addr("::2", 0)));
+        ok(addrs[3].same_host(make_addr("127.0.0.2", 0)));
+
+        conn.set_preferred_address(make_addr("127.0.0.2", 0));
+        conn.sort_addresses(&addrs);
+        ok(addrs[0].same_host(make_addr("127.0.0.2", 0)), "sort: preferred first");
+        is(addrs.size(), (size_t)4);
+    }
+
+    std::vector<int> fillers;
+    unsigned short hole_port, good_port, refused_port;
+    int hole = black_hole(&hole_port, &fillers);
+    int good = listen_on(128, &good_port);
+    close(listen_on(-1, &refused_port));
+
+    {
+        std::vector<nanowww::Address> addrs;
+        addrs.push_back(make_addr("127.0.0.1", hole_port));
+        addrs.push_back(make_addr("127.0.0.1", good_port));
+        nanowww::Connection conn;
+        conn.set_attempt_delay(0.1);
+        conn.set_deadline(nanowww::Deadline::after(5));
+        double start = nanowww::monotonic_time();
+        ok(conn.connect_any(addrs), "black hole: next address after the delay");
+        double elapsed = nanowww::monotonic_time() - start;
+        ok(elapsed >= 0.09 && elapsed < 1, "black hole: elapsed");
+        is(port_of(conn.peer_address()), good_port, "black hole: winner");
+    }
+
+    {
+        std::vector<nanowww::Address> addrs;
+        addrs.push_back(make_addr("127.0.0.1", hole_port));
+        addrs.push_back(make_addr("127.0.0.1", good_port));
+        nanowww::Connection conn;
+        conn.set_attempt_delay(10);
+        conn.set_attempt_timeout(0.2);
+        conn.set_deadline(nanowww::Deadline::after(5));
+        double start = nanowww::monotonic_time();
+        ok(conn.connect_any(addrs), "attempt timeout");
+        double elapsed = nanowww::monotonic_time() - start;
+        ok(elapsed >= 0.19 && elapsed < 1, "attempt timeout: elapsed");
+    }
+
+    {
+        std::vector<nanowww::Address> addrs;
+        addrs.push_back(make_addr("127.0.0.1", refused_port));
+        addrs.push_back(make_addr("127.0.0.1", good_port));
+        nanowww::Connection conn;
+        conn.set_attempt_delay(10);
+        conn.set_deadline(nanowww::Deadline::after(5));
+        double start = nanowww::monotonic_time();
+        ok(conn.connect_any(addrs), "refused: next address at once");
+        ok(nanowww::monotonic_time() - start < 1, "refused: elapsed");
+    }
+
+    {
+        std::vector<nanowww::Address> addrs;
+        addrs.push_back(make_addr("127.0.0.1", refused_port));
+        nanowww::Connection conn;
+        conn.set_deadline(nanowww::Deadline::after(5));
+        ok(!conn.connect_any(addrs), "all refused");
+        is(conn.errstr(), std::string(strerror(ECONNREFUSED)));
+    }
+
+    {
+        std::vector<nanowww::Address> addrs;
+        addrs.push_back(make_addr("127.0.0.1", hole_port));
+        nanowww::Connection conn;
+        conn.set_deadline(nanowww::Deadline::after(0.3));
+        double start = nanowww::monotonic_time();
+        ok(!conn.connect_any(addrs), "deadline");
+        double elapsed = nanowww::monotonic_time() - start;
+        ok(elapsed >= 0.29 && elapsed < 1, "deadline: elapsed");
+        is(conn.errstr(), std::string(strerror(ETIMEDOUT)));
+    }
+
+    for (size_t i=0; i<fillers.size(); i++) {
+        close(fillers[i]);
+    }
+    close(hole);
+    close(good);
+
+    done_testing();
+}
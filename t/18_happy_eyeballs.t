@@ -0,0 +1 @@
+exec q{t/18_happy_eyeballs} or die
\ No newline at end of file
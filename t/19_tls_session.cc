@@ -0,0 +1,25 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    assert(argc == 2);
+    std::string uri = std::string("https://127.0.0.1:") + argv[1] + "/";
+
+    nanosocket::SSLSocket::GlobalInit();
+
+    nanowww::Client client;
+    client.set_timeout(5);
+    for (int i=0; i<3; i++) {
+        nanowww::Response res;
+        bool ret = client.send_get(&res, uri);
+        if (!ret) {
+            diag(client.errstr().c_str());
+        }
+        printf("%d %d\n", ret ? 1 : 0, res.status());
+    }
+    nanowww::TLSContext::Stats stats = client.tls_context()->stats();
+    printf("full=%lu resumed=%lu\n", stats.full_handshakes, stats.resumed_handshakes);
+    return 0;
+}
@@ -0,0 +1,27 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+
+plan skip_all => 'SSL is not available' unless -x 't/19_tls_session';
+plan skip_all => 'openssl command is not available' unless `openssl version` =~ /SSL/;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/19_tls_session $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        is $res, "1 200\n1 200\n1 200\nfull=1 resumed=2\n";
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+        open STDOUT, '>', '/dev/null';
+        open STDERR, '>', '/dev/null';
+        exec qw(openssl s_server -www -quiet -cert t/dat/server.crt -key t/dat/server.key -accept), $port;
+        die "cannot exec openssl: $!";
+    },
+);
@@ -0,0 +1,47 @@
+#ifndef NANOWWW_ENABLE_TIMING
+#define NANOWWW_ENABLE_TIMING
+#endif
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+// prints "<reused> <phases in order> <bytes counted>" for each request
+static void send(nanowww::Client &client, const std::string &uri) {
+    nanowww::Response res;
+    bool ret = client.send_get(&res, uri.c_str());
+    if (!client.errstr().empty()) {
+        diag(client.errstr().c_str());
+    }
+    assert(ret);
+    const nanowww::Response::Timing *t = res.timing();
+    bool ordered;
+    if (t->reused) {
+        ordered = t->connect_start == 0 && t->dns_done == 0 && t->connect_done == 0
+               && t->start <= t->request_sent;
+    } else {
+        ordered = t->start <= t->connect_start && t->connect_start <= t->dns_done
+               && t->dns_done <= t->connect_done && t->connect_done <= t->request_sent;
+    }
+    ordered = ordered && t->tls_done == 0 && t->request_sent <= t->first_byte
+           && t->first_byte <= t->done;
+    bool counted = t->bytes_sent > 0 && t->bytes_received > res.content().size()
+                && t->recv_calls > 0;
+    printf("%d %d %d\n", t->reused ? 1 : 0, ordered ? 1 : 0, counted ? 1 : 0);
+}
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::Client client;
+    client.set_timeout(3);
+    client.set_keepalive(true);
+    send(client, uri);
+    send(client, uri);
+
+    nanowww::Metrics::Snapshot snap = nanowww::Metrics::global().snapshot();
+    printf("%llu %llu %llu %llu\n", snap.requests, snap.errors, snap.connections, snap.reused);
+    std::string text = nanowww::Metrics::global().format();
+    printf("%d\n", text.find("nanowww_request_duration_seconds_count 2\n") != std::string::npos ? 1 : 0);
+    return 0;
+}
@@ -0,0 +1,37 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/20_timing $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my @lines = split /\n/, $res;
+        is_deeply \@lines, [
+            '0 1 1', # new connection
+            '1 1 1', # reused
+            '2 0 1 1',
+            '1',
+        ];
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            while ( my $r = $c->get_request ) {
+                $c->send_response(HTTP::Response->new(200, 'ok', [], 'hello'));
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
@@ -0,0 +1,51 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+static bool same_as_expected(const char *path, size_t size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    size_t i = 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF) {
+        if (c != (int)((i * 7) % 251)) {
+            break;
+        }
+        ++i;
+    }
+    fclose(fp);
+    return i == size && c == EOF;
+}
+
+// prints "<ok> <ranged> <retries> <content is same>"
+static void download(const std::string &uri, const char *path) {
+    nanowww::Downloader dl;
+    dl.set_timeout(3);
+    dl.set_connections(3);
+    dl.set_chunk_size(10000);
+    bool ok = dl.download(uri.c_str(), path);
+    if (!ok) {
+        diag(dl.errstr().c_str());
+    }
+    printf("%d %d %llu %d\n", ok ? 1 : 0, dl.ranged() ? 1 : 0, dl.retries(),
+        same_as_expected(path, 100000) ? 1 : 0);
+}
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    char path[] = "/tmp/nanowww-download-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    download(uri + "ranged", path);
+    download(uri + "plain", path);
+    download(uri + "flaky", path);
+    download(uri + "moved", path);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,69 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+my $data = join '', map { chr(($_ * 7) % 251) } 0..99999;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/21_download $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my @lines = split /\n/, $res;
+        is_deeply \@lines, [
+            '1 1 0 1',  # ranges in parallel
+            '1 0 0 1',  # no Accept-Ranges, single stream
+            '1 1 10 1', # every range is cut once, and resumed
+            '1 1 0 1',  # ranges go to the redirected URI
+        ];
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my $reply = sub {
+            my ($c, $status, $headers, $body, $length) = @_;
+            $length = length($body) unless defined $length;
+            print $c "HTTP/1.1 $status\r\nConnection: close\r\nContent-Length: $length\r\n";
+            print $c map { "$_\r\n" } @$headers;
+            print $c "\r\n", $body;
+        };
+        my %cut;
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            if (my $r = $c->get_request) {
+                my $path = $r->uri->path;
+                if ($path eq '/moved') {
+                    # only the probe comes here
+                    if ($r->method eq 'HEAD') {
+                        $reply->($c, '302 Found', ['Location: /ranged'], '');
+                    } else {
+                        $reply->($c, '404 Not Found', [], '');
+                    }
+                } elsif ($path eq '/plain') {
+                    $reply->($c, '200 OK', [], $data);
+                } elsif (($r->header('Range') || '') =~ /^bytes=(\d+)-(\d+)$/) {
+                    my ($first, $last) = ($1, $2);
+                    my $body = substr($data, $first, $last - $first + 1);
+                    my @headers = ("Content-Range: bytes $first-$last/" . length($data));
+                    if ($path eq '/flaky' && $first % 10000 == 0 && !$cut{$first}++) {
+                        # declare the whole range, but send a half and close
+                        $reply->($c, '206 Partial Content', \@headers, substr($body, 0, length($body) / 2), length($body));
+                    } else {
+                        $reply->($c, '206 Partial Content', \@headers, $body);
+                    }
+                } else {
+                    $reply->($c, '200 OK', ['Accept-Ranges: bytes'], $r->method eq 'HEAD' ? '' : $data, length($data));
+                }
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
@@ -0,0 +1,69 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+// counts the bytes which bypassed on_body()
+class CountingWriter : public nanowww::FileWriter {
+public:
+    size_t spliced;
+    CountingWriter(int fd) : nanowww::FileWriter(fd, 0), spliced(0) { }
+    bool on_spliced(size_t len) {
+        spliced += len;
+        return nanowww::FileWriter::on_spliced(len);
+    }
+};
+
+static size_t count_x(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    assert(fp);
+    size_t n = 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF && c == 'x') {
+        ++n;
+    }
+    fclose(fp);
+    return n;
+}
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    char path[] = "/tmp/nanowww-save-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    nanowww::Client client;
+    client.set_timeout(3);
+    client.set_keepalive(true);
+    {
+        // "<ok> <status> <content size> <bytes in file>"
+        nanowww::Request req("GET", uri.c_str());
+        nanowww::Response res;
+        bool ok = client.save_to_file(req, &res, path);
+        printf("%d %d %d %d\n", ok ? 1 : 0, res.status(), (int)res.content().size(), (int)count_x(path));
+    }
+    {
+        nanowww::Request req("GET", (uri + "404").c_str());
+        nanowww::Response res;
+        bool ok = client.save_to_file(req, &res, path);
+        printf("%d %d %s\n", ok ? 1 : 0, res.status(), client.errstr().c_str());
+    }
+#ifdef __linux__
+    {
+        // "<ok> <spliced or not>"
+        fd = open(path, O_WRONLY | O_TRUNC);
+        CountingWriter writer(fd);
+        nanowww::Request req("GET", uri.c_str());
+        nanowww::Response res;
+        bool ok = client.send_request(req, &res, &writer);
+        close(fd);
+        printf("%d %d\n", ok ? 1 : 0, writer.spliced > 0 && count_x(path) == 1000000 ? 1 : 0);
+    }
+#else
+    printf("1 1\n");
+#endif
+    unlink(path);
+    return 0;
+}
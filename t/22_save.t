@@ -0,0 +1,40 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/22_save $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my @lines = split /\n/, $res;
+        is_deeply \@lines, [
+            '1 200 0 1000000',
+            '0 404 unexpected status: not found',
+            '1 1',
+        ];
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            while ( my $r = $c->get_request ) {
+                if ($r->uri->path eq '/404') {
+                    $c->send_response(HTTP::Response->new(404, 'not found', [], 'not found'));
+                } else {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], 'x' x 1000000));
+                }
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
@@ -0,0 +1,45 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::Client client;
+    client.set_timeout(3);
+    client.set_pipeline_depth(4);
+
+    std::vector<nanowww::Request*> reqs;
+    std::vector<nanowww::Response*> res;
+    for (int i=0; i<20; i++) {
+        std::ostringstream path;
+        path << uri << i;
+        reqs.push_back(new nanowww::Request("GET", path.str().c_str()));
+        res.push_back(new nanowww::Response());
+    }
+    size_t done = client.send_pipelined(reqs, res);
+    if (!client.errstr().empty()) {
+        diag(client.errstr().c_str());
+    }
+
+    // "<answered> <in order> <connections>"
+    bool ordered = true;
+    std::map<std::string, int> ports;
+    for (size_t i=0; i<done; i++) {
+        std::ostringstream expected;
+        expected << "/" << i << " ";
+        const std::string &content = res[i]->content();
+        if (res[i]->status() != 200 || content.compare(0, expected.str().size(), expected.str()) != 0) {
+            ordered = false;
+        }
+        ports[content.substr(expected.str().size())]++;
+    }
+    printf("%d %d %d\n", (int)done, ordered ? 1 : 0, (int)ports.size());
+
+    for (size_t i=0; i<reqs.size(); i++) {
+        delete reqs[i];
+        delete res[i];
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/23_pipeline $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my ($done, $ordered, $connections) = split / /, $res;
+        is $done, 20, 'all answered';
+        is $ordered, 1, 'responses are in order';
+        cmp_ok $connections, '>=', 3, 'replayed on new connections';
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        # closes the connection after 7 responses, with requests left unanswered
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            my $n = 0;
+            while ( my $r = $c->get_request ) {
+                $c->send_response(HTTP::Response->new(200, 'ok', [], join(' ', $r->uri->path, $c->peerport)));
+                last if ++$n >= 7;
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
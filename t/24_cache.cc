@@ -0,0 +1,101 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+#include <dirent.h>
+
+static std::string get(nanowww::Client &client, const std::string &uri, nanowww::Response *res) {
+    nanowww::Request req("GET", uri.c_str());
+    if (!client.send_request(req, res)) {
+        return "error: " + client.errstr();
+    }
+    return res->content();
+}
+
+// values of the field, joined by ","
+static std::string values(nanowww::Response &res, const char *name) {
+    std::string joined;
+    for (size_t i=0; i<res.headers()->size(); i++) {
+        if (res.headers()->name(i).equals_nocase(name)) {
+            joined += (joined.empty() ? "" : ",") + res.headers()->value(i).str();
+        }
+    }
+    return joined;
+}
+
+static void remove_dir(const char *path) {
+    DIR *dir = opendir(path);
+    assert(dir);
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+            unlink((std::string(path) + "/" + ent->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::ResponseCache cache;
+    nanowww::Client client;
+    client.set_timeout(3);
+    client.set_cache(&cache);
+    {
+        // max-age: the second one isn't sent
+        nanowww::Response res1, res2;
+        std::string c1 = get(client, uri + "fresh", &res1);
+        std::string c2 = get(client, uri + "fresh", &res2);
+        printf("%s %s\n", c1.c_str(), c2.c_str());
+    }
+    {
+        // no-cache + ETag: revalidated by 304, and the body is shared.
+        // the fields of 304 replace the stored ones, repeated or not.
+        nanowww::Response res1, res2;
+        std::string c1 = get(client, uri + "etag", &res1);
+        std::string c2 = get(client, uri + "etag", &res2);
+        printf("%s %d %s %d %s\n", c1.c_str(), res2.status(), c2.c_str(),
+               res1.content().data() == res2.content().data() ? 1 : 0, values(res2, "Link").c_str());
+    }
+    {
+        nanowww::Response res1, res2;
+        std::string c1 = get(client, uri + "nostore", &res1);
+        std::string c2 = get(client, uri + "nostore", &res2);
+        printf("%s %s\n", c1.c_str(), c2.c_str());
+    }
+    {
+        // "<hits> <misses> <revalidations> <stores> <entries>"
+        nanowww::ResponseCache::Stats stats = cache.stats();
+        printf("%lu %lu %lu %lu %d\n", stats.hits, stats.misses, stats.revalidations, stats.stores,
+               (int)cache.size());
+    }
+    {
+        // POST invalidates the URI
+        nanowww::Request post("POST", (uri + "fresh").c_str(), "x=y");
+        nanowww::Response res;
+        client.send_request(post, &res);
+        std::string c = get(client, uri + "fresh", &res);
+        printf("%s\n", c.c_str());
+    }
+    {
+        // entries evicted to the disk tier are found by another cache
+        char dir[] = "/tmp/nanowww-cache-XXXXXX";
+        assert(mkdtemp(dir));
+        cache.set_disk_tier(dir, 1024 * 1024);
+        cache.set_max_bytes(0);
+
+        nanowww::ResponseCache cache2;
+        cache2.set_disk_tier(dir, 1024 * 1024);
+        nanowww::Client client2;
+        client2.set_timeout(3);
+        client2.set_cache(&cache2);
+        nanowww::Response res;
+        std::string c = get(client2, uri + "fresh", &res);
+        nanowww::ResponseCache::Stats stats = cache2.stats();
+        printf("%s %lu %lu %d\n", c.c_str(), stats.disk_hits, stats.hits, (int)cache.size());
+        remove_dir(dir);
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/24_cache $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my @lines = split /\n/, $res;
+        is_deeply \@lines, [
+            'fresh 1 fresh 1',
+            'etag 1 200 etag 1 1 </a>,</b>',
+            'nostore 1 nostore 2',
+            '1 4 1 3 2',
+            'fresh 2',
+            'fresh 2 1 1 0',
+        ];
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my %count;
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            while ( my $r = $c->get_request ) {
+                my $path = $r->uri->path;
+                $path =~ s{^/}{};
+                if ($r->method eq 'POST') {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], 'posted'));
+                } elsif ($path eq 'fresh') {
+                    my $n = ++$count{$path};
+                    $c->send_response(HTTP::Response->new(200, 'ok', ['Cache-Control' => 'max-age=60'], "fresh $n"));
+                } elsif ($path eq 'etag') {
+                    if (($r->header('If-None-Match') || '') eq '"v1"') {
+                        $c->send_response(HTTP::Response->new(304, 'not modified', ['ETag' => '"v1"', 'Link' => '</a>', 'Link' => '</b>']));
+                    } else {
+                        my $n = ++$count{$path};
+                        $c->send_response(HTTP::Response->new(200, 'ok', ['Cache-Control' => 'no-cache', 'ETag' => '"v1"', 'Link' => '</old>'], "etag $n"));
+                    }
+                } else {
+                    my $n = ++$count{$path};
+                    $c->send_response(HTTP::Response->new(200, 'ok', ['Cache-Control' => 'no-store'], "$path $n"));
+                }
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
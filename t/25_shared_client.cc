@@ -0,0 +1,68 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+#define THREADS  8
+#define REQUESTS 20
+
+struct Worker {
+    nanowww::SharedClient *client;
+    std::string uri;
+    int ok;
+    pthread_t thread;
+};
+
+static void * worker_main(void *arg) {
+    Worker *w = (Worker *)arg;
+    for (int i=0; i<REQUESTS; i++) {
+        nanowww::Response res;
+        std::string error;
+        if (w->client->send_get(&res, w->uri, &error) && res.status() == 200 && res.content() == "hello") {
+            ++w->ok;
+        } else {
+            fprintf(stderr, "%s\n", error.c_str());
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::SharedClient::Config config;
+    config.timeout   = 5;
+    config.keepalive = true;
+    nanowww::SharedClient client(config);
+    {
+        // "<succeeded> <idle connections are kept>"
+        Worker workers[THREADS];
+        for (int i=0; i<THREADS; i++) {
+            workers[i].client = &client;
+            workers[i].uri    = uri;
+            workers[i].ok     = 0;
+            pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        }
+        int ok = 0;
+        for (int i=0; i<THREADS; i++) {
+            pthread_join(workers[i].thread, NULL);
+            ok += workers[i].ok;
+        }
+        size_t idle = client.pool()->size();
+        printf("%d %d\n", ok, idle > 0 && idle <= THREADS ? 1 : 0);
+    }
+    {
+        // the error is for the request
+        nanowww::Response res;
+        std::string error;
+        bool ok = client.send_get(&res, "http://127.0.0.1:1/", &error);
+        printf("%d %d\n", ok ? 1 : 0, error.empty() ? 0 : 1);
+    }
+    {
+        nanowww::Response res;
+        std::string error;
+        bool ok = client.send_get(&res, uri, &error);
+        printf("%d %s %s\n", ok ? 1 : 0, res.content().c_str(), error.c_str());
+    }
+    return 0;
+}
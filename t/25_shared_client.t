@@ -0,0 +1,42 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/25_shared_client $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my @lines = split /\n/, $res;
+        is_deeply \@lines, [
+            '160 1',
+            '0 1',
+            '1 hello ',
+        ];
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        $SIG{CHLD} = 'IGNORE';
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            # keep-alive connections of the threads are served at once
+            if (fork() == 0) {
+                while ( my $r = $c->get_request ) {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], 'hello'));
+                }
+                $c->close;
+                exit 0;
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
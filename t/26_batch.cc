@@ -0,0 +1,75 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+class CountingCallback : public nanowww::BatchExecutor::Callback {
+public:
+    volatile int count;
+    CountingCallback() : count(0) { }
+    void on_complete(size_t, nanowww::Request &, nanowww::BatchExecutor::Result &) {
+        __sync_add_and_fetch(&count, 1);
+    }
+};
+
+static void make_requests(std::vector<nanowww::Request*> *reqs, const std::string &base, int n) {
+    for (int i=0; i<n; i++) {
+        std::ostringstream uri;
+        uri << base << i;
+        reqs->push_back(new nanowww::Request("GET", uri.str().c_str()));
+    }
+}
+
+static void free_requests(std::vector<nanowww::Request*> *reqs) {
+    for (size_t i=0; i<reqs->size(); i++) {
+        delete (*reqs)[i];
+    }
+    reqs->clear();
+}
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::SharedClient::Config config;
+    config.timeout   = 5;
+    config.keepalive = true;
+    {
+        // "<succeeded> <in order> <callbacks>"
+        nanowww::BatchExecutor executor(4, 0, config);
+        std::vector<nanowww::Request*> reqs;
+        make_requests(&reqs, uri, 50);
+        std::vector<nanowww::BatchExecutor::Result> results;
+        CountingCallback callback;
+        size_t ok = executor.run(reqs, &results, &callback);
+        bool ordered = results.size() == 50;
+        for (size_t i=0; i<results.size(); i++) {
+            std::ostringstream expected;
+            expected << "/" << i;
+            ordered = ordered && results[i].response.content() == expected.str();
+        }
+        printf("%d %d %d\n", (int)ok, ordered ? 1 : 0, callback.count);
+        free_requests(&reqs);
+
+        // the error is for each request
+        reqs.push_back(new nanowww::Request("GET", uri.c_str()));
+        reqs.push_back(new nanowww::Request("GET", "http://127.0.0.1:1/"));
+        reqs.push_back(new nanowww::Request("GET", uri.c_str()));
+        executor.run(reqs, &results);
+        printf("%d %d %d %d\n", results[0].ok ? 1 : 0, results[1].ok ? 1 : 0, results[2].ok ? 1 : 0,
+               results[1].error.empty() ? 0 : 1);
+        free_requests(&reqs);
+    }
+    {
+        // 6 requests of 0.2 sec, 2 at once
+        nanowww::BatchExecutor executor(6, 2, config);
+        std::vector<nanowww::Request*> reqs;
+        make_requests(&reqs, uri + "delay/", 6);
+        std::vector<nanowww::BatchExecutor::Result> results;
+        double start = nanowww::monotonic_time();
+        size_t ok = executor.run(reqs, &results);
+        double elapsed = nanowww::monotonic_time() - start;
+        printf("%d %d\n", (int)ok, elapsed >= 0.55 ? 1 : 0);
+        free_requests(&reqs);
+    }
+    return 0;
+}
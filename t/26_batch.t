@@ -0,0 +1,46 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/26_batch $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my @lines = split /\n/, $res;
+        is_deeply \@lines, [
+            '50 1 50',
+            '1 0 1 1',
+            '6 1',
+        ];
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        $SIG{CHLD} = 'IGNORE';
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            # the workers' connections are served at once
+            if (fork() == 0) {
+                while ( my $r = $c->get_request ) {
+                    my $path = $r->uri->path;
+                    if ($path =~ m{^/delay/}) {
+                        select undef, undef, undef, 0.2;
+                    }
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], $path));
+                }
+                $c->close;
+                exit 0;
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
@@ -0,0 +1,119 @@
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+// "abc" x 3 in pieces of 3 bytes, then 1MB in pieces of 1000 bytes
+struct Producer {
+    size_t remains;
+    size_t piece;
+};
+
+static ssize_t produce(void *arg, char *buf, size_t len) {
+    Producer *p = (Producer *)arg;
+    size_t n = std::min(std::min(len, p->piece), p->remains);
+    for (size_t i=0; i<n; i++) {
+        buf[i] = "abc"[i % 3];
+    }
+    p->remains -= n;
+    return n;
+}
+
+static std::string post(nanowww::Client &client, nanowww::Request &req) {
+    nanowww::Response res;
+    if (!client.send_request(req, &res)) {
+        return "0 " + client.errstr();
+    }
+    std::ostringstream os;
+    os << res.status() << " " << res.content();
+    return os.str();
+}
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::Client client;
+    client.set_timeout(5);
+    std::string binary("a\0b\0c", 5);
+    {
+        // chunked encoding, and HTTP/1.1 for it
+        Producer producer = { 9, 3 };
+        nanowww::CallbackBodySource source(produce, &producer);
+        nanowww::Request req("POST", uri.c_str());
+        req.set_body(&source);
+        std::string out;
+        nanowww::BufferSocket sock(&out);
+        std::string buf;
+        req.set_protocol("HTTP/1.0");
+        bool ok = req.write_request(sock, false, &buf);
+        size_t body = out.find("\r\n\r\n") + 4;
+        printf("%d %d %d %s\n", ok ? 1 : 0,
+            out.compare(0, out.find("\r\n"), "POST / HTTP/1.1") == 0 ? 1 : 0,
+            req.headers()->has_header("Content-Length") ? 0 : 1,
+            out.substr(body) == "3\r\nabc\r\n3\r\nabc\r\n3\r\nabc\r\n0\r\n\r\n" ? "chunked" : out.c_str());
+    }
+    {
+        nanowww::BufferBodySource source(binary.data(), binary.size());
+        nanowww::Request req("POST", (uri + "echo").c_str());
+        req.set_body(&source);
+        std::string res = post(client, req);
+        printf("%d\n", res == "200 " + binary ? 1 : 0);
+    }
+    {
+        nanowww::Request req("POST", (uri + "echo").c_str(), binary);
+        std::string res = post(client, req);
+        printf("%d\n", res == "200 " + binary ? 1 : 0);
+    }
+    {
+        Producer producer = { 1000000, 1000 };
+        nanowww::CallbackBodySource source(produce, &producer);
+        nanowww::Request req("POST", (uri + "length").c_str());
+        req.set_body(&source);
+        printf("%s\n", post(client, req).c_str());
+    }
+    {
+        // regular file: Content-Length
+        char path[] = "/tmp/nanowww-body-XXXXXX";
+        int fd = mkstemp(path);
+        assert(fd != -1);
+        std::string data(100000, 'f');
+        assert(write(fd, data.data(), data.size()) == (ssize_t)data.size());
+        lseek(fd, 0, SEEK_SET);
+        nanowww::FdBodySource source(fd);
+        nanowww::Request req("POST", (uri + "length").c_str());
+        req.set_body(&source);
+        printf("%d %s\n", (int)source.length(), post(client, req).c_str());
+        close(fd);
+        unlink(path);
+    }
+    {
+        // pipe: chunked
+        int fds[2];
+        assert(pipe(fds) == 0);
+        std::string data(10000, 'p');
+        assert(write(fds[1], data.data(), data.size()) == (ssize_t)data.size());
+        close(fds[1]);
+        nanowww::FdBodySource source(fds[0]);
+        nanowww::Request req("POST", (uri + "length").c_str());
+        req.set_body(&source);
+        printf("%d %s\n", (int)source.length(), post(client, req).c_str());
+        close(fds[0]);
+    }
+    {
+        // 307 sends the body again
+        nanowww::BufferBodySource source(binary.data(), binary.size());
+        nanowww::Request req("POST", (uri + "307").c_str());
+        req.set_body(&source);
+        std::string res = post(client, req);
+        printf("%d\n", res == "200 " + binary ? 1 : 0);
+    }
+    {
+        // but the callback can't
+        Producer producer = { 9, 3 };
+        nanowww::CallbackBodySource source(produce, &producer);
+        nanowww::Request req("POST", (uri + "307").c_str());
+        req.set_body(&source);
+        printf("%s\n", post(client, req).c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/27_body $port`;
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        my @lines = split /\n/, $res;
+        is_deeply \@lines, [
+            '1 1 1 chunked',
+            '1',
+            '1',
+            '200 1000000',
+            '100000 200 100000',
+            '-1 200 10000',
+            '1',
+            '0 error in writing request',
+        ];
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port) || die;
+        while ( my $c = $d->accept ) {
+            while ( my $r = $c->get_request ) {
+                my $path = $r->uri->path;
+                if ($path eq '/307') {
+                    $c->send_response(HTTP::Response->new(307, 'temporary redirect', ['Location' => '/echo']));
+                } elsif ($path eq '/echo') {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], $r->content));
+                } else {
+                    $c->send_response(HTTP::Response->new(200, 'ok', [], length($r->content)));
+                }
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);
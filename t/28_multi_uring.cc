@@ -0,0 +1,54 @@
+// only two registered buffers, so that they are reused after the cancellation
+#define NANOWWW_URING_BUFFERS 2
+#include "../nanowww.h"
+#include <nanotap/nanotap.h>
+#include "test_util.h"
+
+int main(int argc, char **argv) {
+    ignore_sigpipe();
+    std::string uri = gen_uri(argc, argv);
+
+    nanowww::MultiClient multi(nanowww::MultiClient::BACKEND_URING);
+    if (multi.backend() != nanowww::MultiClient::BACKEND_URING) {
+        printf("no io_uring\n");
+        return 0;
+    }
+    multi.set_timeout(1);
+
+    const int STALL = 2;
+    const int N = 6;
+    std::vector<nanowww::Request*> reqs;
+    std::vector<nanowww::Response> res(STALL+N);
+
+    // these hold the buffers until they time out and the reads are cancelled
+    for (int i=0; i<STALL; i++) {
+        reqs.push_back(new nanowww::Request("GET", (uri + "stall").c_str()));
+        multi.add(*reqs.back(), &res[i]);
+    }
+    for (int i=0; i<N; i++) {
+        char path[32];
+        sprintf(path, "%d", i);
+        reqs.push_back(new nanowww::Request("GET", (uri + path).c_str()));
+        multi.add(*reqs.back(), &res[STALL+i]);
+    }
+
+    bool ret = multi.run();
+    printf("run=%d\n", ret ? 1 : 0);
+    for (int i=0; i<STALL; i++) {
+        printf("stall=%d\n", multi.is_success(i) ? 1 : 0);
+    }
+    for (int i=0; i<N; i++) {
+        char c = '0' + i;
+        const std::string &content = res[STALL+i].content();
+        bool intact = content.size() == 200000
+            && content.find_first_not_of(c) == std::string::npos;
+        printf("%d=%s\n", i, intact ? "ok" : "broken");
+        if (!multi.is_success(STALL+i)) {
+            diag(multi.errstr(STALL+i).c_str());
+        }
+    }
+    for (size_t i=0; i<reqs.size(); i++) {
+        delete reqs[i];
+    }
+    return 0;
+}
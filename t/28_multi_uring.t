@@ -0,0 +1,47 @@
+use strict;
+use warnings;
+use Test::TCP;
+use Test::More;
+use POSIX;
+use HTTP::Daemon;
+use HTTP::Status;
+
+plan skip_all => 'liburing is not available' unless -x 't/28_multi_uring';
+
+test_tcp(
+    client => sub {
+        my $port = shift;
+        my $res  = `./t/28_multi_uring $port`;
+        # built with liburing, but the kernel doesn't support it
+        plan skip_all => 'io_uring is not available' if $res eq "no io_uring\n";
+        ok POSIX::WIFEXITED($?),    "exit";
+        ok !POSIX::WIFSIGNALED($?), "signal";
+        is POSIX::WTERMSIG($?),     0, 'signal';
+        is $res, join("", "run=0\n", "stall=0\n" x 2, map { "$_=ok\n" } 0..5);
+        done_testing;
+    },
+    server => sub {
+        my $port = shift;
+
+        $SIG{CHLD} = 'IGNORE';
+        my $d = HTTP::Daemon->new(ReuseAddr => 1, LocalPort => $port, Listen => 20) || die;
+        while ( my $c = $d->accept ) {
+            # the stalled connections must not block the others
+            if (fork() == 0) {
+                while ( my $r = $c->get_request ) {
+                    my ($path) = $r->uri->path =~ m{^/(.*)};
+                    if ($path eq 'stall') {
+                        sleep 3;
+                        $c->send_response(HTTP::Response->new(200, 'ok', [], 'x' x 200000));
+                    } else {
+                        $c->send_response(HTTP::Response->new(200, 'ok', [], $path x 200000));
+                    }
+                }
+                $c->close;
+                exit 0;
+            }
+            $c->close;
+            undef($c);
+        }
+    },
+);